@@ -0,0 +1,198 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <jemalloc/jemalloc.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <uv.h>
+
+#include "alloc.h"
+#include "mctx.h"
+#include "pool.h"
+
+#if defined(__GLIBC__)
+/* The glibc allocator under the jemalloc that replaces malloc() */
+extern void *
+__libc_malloc(size_t size);
+extern void
+__libc_free(void *ptr);
+#define libc_malloc(size) __libc_malloc(size)
+#define libc_free(ptr)	  __libc_free(ptr)
+#else /* if defined(__GLIBC__) */
+#define libc_malloc(size) malloc(size)
+#define libc_free(ptr)	  free(ptr)
+#endif /* if defined(__GLIBC__) */
+
+const char *allocator_names[ALLOCATOR_MAX] = {
+	[ALLOCATOR_JEMALLOC] = "jemalloc",
+	[ALLOCATOR_JEMALLOC_ARENA] = "je-arena",
+	[ALLOCATOR_JEMALLOC_NOTCACHE] = "je-notcache",
+	[ALLOCATOR_MALLOC] = "malloc",
+	[ALLOCATOR_POOL] = "pool",
+	[ALLOCATOR_MCTX] = "mctx",
+};
+
+static enum allocator allocator = ALLOCATOR_JEMALLOC;
+
+/*
+ * The private arenas can't be destroyed while the remote frees may still
+ * be pending, so the arena of an exited thread is handed to the next new
+ * thread instead.
+ */
+#define ARENA_NONE ((unsigned)-1)
+
+struct arena {
+	unsigned index;
+	struct arena *next;
+};
+
+static uv_once_t arena_once = UV_ONCE_INIT;
+static uv_mutex_t arena_lock;
+static struct arena *arena_free = NULL;
+static tss_t arena_key;
+static thread_local bool arena_bound = false;
+
+static void
+arena_thread_exit(void *arg) {
+	struct arena *arena = arg;
+
+	uv_mutex_lock(&arena_lock);
+	arena->next = arena_free;
+	arena_free = arena;
+	uv_mutex_unlock(&arena_lock);
+}
+
+static void
+arena_initialize(void) {
+	int r = uv_mutex_init(&arena_lock);
+	assert(r == 0);
+
+	r = tss_create(&arena_key, arena_thread_exit);
+	assert(r == thrd_success);
+}
+
+/*
+ * Bind the calling thread to a private arena, the thread cache stays in
+ * use and flushes the freed objects back to their own arenas.
+ */
+static void
+arena_bind(void) {
+	if (arena_bound) {
+		return;
+	}
+
+	uv_once(&arena_once, arena_initialize);
+
+	uv_mutex_lock(&arena_lock);
+	struct arena *arena = arena_free;
+	if (arena != NULL) {
+		arena_free = arena->next;
+	}
+	uv_mutex_unlock(&arena_lock);
+
+	if (arena == NULL) {
+		arena = malloc(sizeof(*arena));
+		arena->index = ARENA_NONE;
+
+		size_t len = sizeof(arena->index);
+		if (mallctl("arenas.create", &arena->index, &len, NULL, 0) != 0) {
+			/* Stay with the automatic arenas */
+			arena->index = ARENA_NONE;
+		}
+	}
+
+	if (arena->index != ARENA_NONE) {
+		int r = mallctl("thread.arena", NULL, NULL, &arena->index, sizeof(arena->index));
+		assert(r == 0);
+	}
+
+	int r = tss_set(arena_key, arena);
+	assert(r == thrd_success);
+
+	arena_bound = true;
+}
+
+bool
+allocator_set(const char *name) {
+	for (size_t i = 0; i < ALLOCATOR_MAX; i++) {
+		if (strcmp(name, allocator_names[i]) == 0) {
+			allocator = i;
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+void
+allocator_select(enum allocator a) {
+	assert(a < ALLOCATOR_MAX);
+
+	allocator = a;
+}
+
+enum allocator
+allocator_get(void) {
+	return (allocator);
+}
+
+const char *
+allocator_name(void) {
+	return (allocator_names[allocator]);
+}
+
+void *
+node_alloc(size_t size) {
+	switch (allocator) {
+	case ALLOCATOR_JEMALLOC:
+		return (mallocx(size, 0));
+	case ALLOCATOR_JEMALLOC_ARENA:
+		arena_bind();
+		return (mallocx(size, 0));
+	case ALLOCATOR_JEMALLOC_NOTCACHE:
+		return (mallocx(size, MALLOCX_TCACHE_NONE));
+	case ALLOCATOR_MALLOC:
+		return (libc_malloc(size));
+	case ALLOCATOR_POOL:
+		return (pool_alloc(size));
+	case ALLOCATOR_MCTX:
+		return (mctx_alloc(size));
+	default:
+		abort();
+	}
+}
+
+void
+node_free(void *ptr, size_t size) {
+	switch (allocator) {
+	case ALLOCATOR_JEMALLOC:
+	case ALLOCATOR_JEMALLOC_ARENA:
+		/* jemalloc finds the arena that owns the node itself */
+		sdallocx(ptr, size, 0);
+		break;
+	case ALLOCATOR_JEMALLOC_NOTCACHE:
+		sdallocx(ptr, size, MALLOCX_TCACHE_NONE);
+		break;
+	case ALLOCATOR_MALLOC:
+		libc_free(ptr);
+		break;
+	case ALLOCATOR_POOL:
+		pool_free(ptr, size);
+		break;
+	case ALLOCATOR_MCTX:
+		mctx_free(ptr, size);
+		break;
+	default:
+		abort();
+	}
+}
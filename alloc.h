@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file alloc.h
+ * Allocator selection for the benchmark nodes.
+ *
+ * All the nodes the benchmark threads allocate and free go through
+ * node_alloc() and node_free(), so the allocator can be switched between
+ * jemalloc, the glibc malloc (which is otherwise shadowed by the linked-in
+ * jemalloc), the per-thread slab pool from pool.h and the per-loop memory
+ * contexts from mctx.h.
+ *
+ * The jemalloc allocator comes in three tunings: the default automatic
+ * arenas with the thread cache, a private arena for every thread (so the
+ * threads never share an arena lock, and the remote frees go back to the
+ * arena of the allocating thread), and the default arenas with the thread
+ * cache bypassed, which shows how much of the cost the tcache hides.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum allocator {
+	ALLOCATOR_JEMALLOC = 0,
+	ALLOCATOR_JEMALLOC_ARENA,
+	ALLOCATOR_JEMALLOC_NOTCACHE,
+	ALLOCATOR_MALLOC,
+	ALLOCATOR_POOL,
+	ALLOCATOR_MCTX,
+	ALLOCATOR_MAX,
+};
+
+extern const char *allocator_names[ALLOCATOR_MAX];
+
+bool
+allocator_set(const char *name);
+/*%<
+ * Select the allocator by its name, false if there's no such allocator.
+ */
+
+void
+allocator_select(enum allocator allocator);
+/*%<
+ * Switch the allocator between the runs, all the nodes allocated with the
+ * previous allocator must have been freed, including the deferred frees.
+ */
+
+enum allocator
+allocator_get(void);
+
+const char *
+allocator_name(void);
+
+void *
+node_alloc(size_t size);
+
+void
+node_free(void *ptr, size_t size);
+/*%<
+ * 'size' must be the size the node was allocated with.
+ */
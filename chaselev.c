@@ -0,0 +1,151 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+#include "chaselev.h"
+
+struct chaselev_array {
+	size_t mask;
+	struct chaselev_array *prev; /* The smaller arrays, kept for the thieves */
+	void *_Atomic slots[];
+};
+
+struct chaselev {
+	alignas(64) atomic_int_fast64_t top;
+	alignas(64) atomic_int_fast64_t bottom;
+	_Atomic(struct chaselev_array *) array;
+};
+
+static struct chaselev_array *
+chaselev_array_new(size_t size, struct chaselev_array *prev) {
+	struct chaselev_array *array = malloc(sizeof(*array) + size * sizeof(array->slots[0]));
+
+	array->mask = size - 1;
+	array->prev = prev;
+
+	return (array);
+}
+
+static void *
+chaselev_get(struct chaselev_array *array, int_fast64_t i) {
+	return (atomic_load_relaxed(&array->slots[i & array->mask]));
+}
+
+static void
+chaselev_put(struct chaselev_array *array, int_fast64_t i, void *ptr) {
+	atomic_store_relaxed(&array->slots[i & array->mask], ptr);
+}
+
+static struct chaselev_array *
+chaselev_grow(struct chaselev *deque, struct chaselev_array *array, int_fast64_t top, int_fast64_t bottom) {
+	struct chaselev_array *grown = chaselev_array_new(2 * (array->mask + 1), array);
+
+	for (int_fast64_t i = top; i < bottom; i++) {
+		chaselev_put(grown, i, chaselev_get(array, i));
+	}
+	atomic_store_release(&deque->array, grown);
+
+	return (grown);
+}
+
+struct chaselev *
+chaselev_new(void) {
+	struct chaselev *deque = aligned_alloc(alignof(struct chaselev), sizeof(*deque));
+
+	atomic_init(&deque->top, 0);
+	atomic_init(&deque->bottom, 0);
+	atomic_init(&deque->array, chaselev_array_new(1 << CHASELEV_ORDER, NULL));
+
+	return (deque);
+}
+
+void
+chaselev_destroy(struct chaselev *deque) {
+	struct chaselev_array *array = atomic_load_relaxed(&deque->array);
+
+	while (array != NULL) {
+		struct chaselev_array *prev = array->prev;
+		free(array);
+		array = prev;
+	}
+
+	free(deque);
+}
+
+void
+chaselev_push(struct chaselev *deque, void *ptr) {
+	int_fast64_t bottom = atomic_load_relaxed(&deque->bottom);
+	int_fast64_t top = atomic_load_acquire(&deque->top);
+	struct chaselev_array *array = atomic_load_relaxed(&deque->array);
+
+	if (bottom - top > (int_fast64_t)array->mask) {
+		array = chaselev_grow(deque, array, top, bottom);
+	}
+
+	chaselev_put(array, bottom, ptr);
+	/* A release store instead of the paper's release fence, same on x86 */
+	atomic_store_release(&deque->bottom, bottom + 1);
+}
+
+void *
+chaselev_pop(struct chaselev *deque) {
+	int_fast64_t bottom = atomic_load_relaxed(&deque->bottom) - 1;
+	struct chaselev_array *array = atomic_load_relaxed(&deque->array);
+
+	atomic_store_relaxed(&deque->bottom, bottom);
+	/* The thieves must see the smaller bottom before we read the top */
+	atomic_thread_fence(memory_order_seq_cst);
+	int_fast64_t top = atomic_load_relaxed(&deque->top);
+
+	if (top > bottom) {
+		/* Empty */
+		atomic_store_relaxed(&deque->bottom, bottom + 1);
+		return (NULL);
+	}
+
+	void *ptr = chaselev_get(array, bottom);
+	if (top == bottom) {
+		/* The last element, race the thieves for it */
+		if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+							     memory_order_relaxed))
+		{
+			ptr = NULL;
+		}
+		atomic_store_relaxed(&deque->bottom, bottom + 1);
+	}
+
+	return (ptr);
+}
+
+void *
+chaselev_steal(struct chaselev *deque) {
+	int_fast64_t top = atomic_load_acquire(&deque->top);
+	atomic_thread_fence(memory_order_seq_cst);
+	int_fast64_t bottom = atomic_load_acquire(&deque->bottom);
+
+	if (top >= bottom) {
+		return (NULL);
+	}
+
+	struct chaselev_array *array = atomic_load_acquire(&deque->array);
+	void *ptr = chaselev_get(array, top);
+	if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+						     memory_order_relaxed))
+	{
+		return (NULL);
+	}
+
+	return (ptr);
+}
@@ -0,0 +1,58 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file chaselev.h
+ * Chase-Lev work-stealing deque of pointers (Chase, Lev: Dynamic Circular
+ * Work-Stealing Deque, SPAA 2005), with the C11 memory orderings from Lê,
+ * Pop, Cohen, Zappa Nardelli: Correct and Efficient Work-Stealing for Weak
+ * Memory Models, PPoPP 2013.
+ *
+ * The deque has a single owner that pushes and pops at the bottom, which
+ * needs no atomic read-modify-write unless the deque is down to its last
+ * element.  Any other thread can steal from the top with a single
+ * compare-and-swap.  The array grows when it's full; the old arrays are
+ * kept until the deque is destroyed, because a thief might still read
+ * from them.
+ */
+
+#include <stddef.h>
+
+#ifndef CHASELEV_ORDER
+#define CHASELEV_ORDER 10 /*%< The initial array has 2^CHASELEV_ORDER slots */
+#endif /* ifndef CHASELEV_ORDER */
+
+struct chaselev;
+
+struct chaselev *
+chaselev_new(void);
+
+void
+chaselev_destroy(struct chaselev *deque);
+/*%<
+ * Free the deque, the elements still in the deque are not freed.
+ */
+
+void
+chaselev_push(struct chaselev *deque, void *ptr);
+/*%<
+ * Push 'ptr' at the bottom, only the owner can push.
+ */
+
+void *
+chaselev_pop(struct chaselev *deque);
+/*%<
+ * Pop the newest element from the bottom, NULL when the deque is empty.
+ * Only the owner can pop.
+ */
+
+void *
+chaselev_steal(struct chaselev *deque);
+/*%<
+ * Steal the oldest element from the top, NULL when the deque is empty or
+ * when another thread has won the race for the element.
+ */
@@ -0,0 +1,388 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+/*
+ * Core-to-core cache-line latency matrix.
+ *
+ * For every pair of CPUs we pin two threads and make them bounce the
+ * readers_ingress counter of a rwlock_t between them, exactly like the
+ * read_indicator_arrive() in rwlock.c does.  The round-trip time of the
+ * cache line is what every contended C-RW-WP reader pays.
+ *
+ * The matrix is printed as CSV (default), as "x y value" triples that can
+ * be fed to gnuplot's "with image" or any other heat-map tool, or as
+ * SMT/cluster/socket groupings derived from the matrix.  The "node" lines of
+ * the groupings can be used as a fake NUMA node map.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <uv.h>
+
+#include "atomic.h"
+#include "rwlock.h"
+#include "util.h"
+
+/*
+ * Two consecutive latency levels are considered distinct topology levels
+ * when the latency jumps by more than this factor.
+ */
+#ifndef COREMAP_LEVEL_GAP
+#define COREMAP_LEVEL_GAP 1.3
+#endif /* ifndef COREMAP_LEVEL_GAP */
+
+enum format {
+	FORMAT_CSV,
+	FORMAT_HEATMAP,
+	FORMAT_GROUPS,
+};
+
+struct thread_s {
+	uv_thread_t thread;
+	uv_barrier_t *barrier;
+	rwlock_t *rwl;
+	int cpu;
+	uint_fast32_t parity;
+	uint64_t iterations;
+	uint64_t samples;
+	uint64_t diff;
+};
+
+static size_t ncpus;
+static int *cpus;
+static double *matrix;
+
+#define LATENCY(i, j) matrix[(i) * ncpus + (j)]
+
+static void
+pin_self(int cpu) {
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (r != 0) {
+		fprintf(stderr, "can't pin thread to CPU %d: %s\n", cpu, strerror(r));
+		exit(1);
+	}
+}
+
+static void
+pingpong_run(void *arg0) {
+	struct thread_s *arg = arg0;
+	atomic_uint_fast32_t *line = &arg->rwl->readers_ingress;
+
+	pin_self(arg->cpu);
+
+	for (size_t s = 0; s < arg->samples; s++) {
+		struct timespec start, end;
+
+		(void)uv_barrier_wait(arg->barrier);
+
+		time_now(&start);
+
+		for (size_t i = 0; i < arg->iterations; i++) {
+			uint_fast32_t expected = 2 * i + arg->parity;
+			while (atomic_load_acquire(line) != expected) {
+				pause();
+			}
+			(void)atomic_fetch_add_release(line, 1);
+		}
+
+		time_now(&end);
+
+		uint64_t diff = time_nanodiff(&end, &start);
+		if (s == 0 || diff < arg->diff) {
+			arg->diff = diff;
+		}
+
+		/* Reset the counter for the next sample */
+		(void)uv_barrier_wait(arg->barrier);
+		if (arg->parity == 0) {
+			atomic_store_release(line, 0);
+		}
+	}
+}
+
+static double
+measure_pair(int cpu1, int cpu2, uint64_t iterations, uint64_t samples) {
+	uv_barrier_t barrier;
+	rwlock_t rwl;
+	struct thread_s threads[2];
+
+	int r = uv_barrier_init(&barrier, 2);
+	assert(r == 0);
+
+	rwlock_init(&rwl);
+
+	for (size_t i = 0; i < 2; i++) {
+		struct thread_s *t = &threads[i];
+		*t = (struct thread_s){
+			.barrier = &barrier,
+			.rwl = &rwl,
+			.cpu = (i == 0) ? cpu1 : cpu2,
+			.parity = i,
+			.iterations = iterations,
+			.samples = samples,
+		};
+
+		r = uv_thread_create(&t->thread, pingpong_run, t);
+		assert(r == 0);
+	}
+
+	for (size_t i = 0; i < 2; i++) {
+		r = uv_thread_join(&threads[i].thread);
+		assert(r == 0);
+	}
+
+	/* Leave the lock in a state rwlock_destroy() accepts */
+	atomic_store_release(&rwl.readers_ingress, 0);
+	rwlock_destroy(&rwl);
+	uv_barrier_destroy(&barrier);
+
+	/* The first thread times full round trips */
+	return ((double)threads[0].diff / iterations);
+}
+
+static void
+print_csv(void) {
+	printf("cpu");
+	for (size_t j = 0; j < ncpus; j++) {
+		printf(",%d", cpus[j]);
+	}
+	printf("\n");
+
+	for (size_t i = 0; i < ncpus; i++) {
+		printf("%d", cpus[i]);
+		for (size_t j = 0; j < ncpus; j++) {
+			printf(",%.1f", LATENCY(i, j));
+		}
+		printf("\n");
+	}
+}
+
+static void
+print_heatmap(void) {
+	printf("# cpu1 cpu2 round-trip-ns\n");
+	for (size_t i = 0; i < ncpus; i++) {
+		for (size_t j = 0; j < ncpus; j++) {
+			printf("%d %d %.1f\n", cpus[i], cpus[j], LATENCY(i, j));
+		}
+		/* gnuplot expects an empty line between the scan lines */
+		printf("\n");
+	}
+}
+
+static size_t
+group_find(size_t *parent, size_t i) {
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return (i);
+}
+
+static int
+double_cmp(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return ((x > y) - (x < y));
+}
+
+static size_t
+group_by(double threshold, size_t *parent) {
+	size_t ngroups = 0;
+
+	for (size_t i = 0; i < ncpus; i++) {
+		parent[i] = i;
+	}
+	for (size_t i = 0; i < ncpus; i++) {
+		for (size_t j = i + 1; j < ncpus; j++) {
+			if (LATENCY(i, j) <= threshold) {
+				parent[group_find(parent, j)] = group_find(parent, i);
+			}
+		}
+	}
+	for (size_t i = 0; i < ncpus; i++) {
+		ngroups += (group_find(parent, i) == i);
+	}
+
+	return (ngroups);
+}
+
+/*
+ * Cluster the CPUs by latency.  The sorted pair latencies are split into
+ * levels wherever the latency jumps by more than COREMAP_LEVEL_GAP, and
+ * every level threshold joins the CPUs that are closer than that into one
+ * group.  The first level is reported as "smt" when its groups have at
+ * most four CPUs, the coarsest level that still has more than one group
+ * as "socket" and anything in between as "cluster".
+ */
+static void
+print_groups(void) {
+	size_t npairs = ncpus * (ncpus - 1) / 2;
+	double *sorted = calloc(npairs, sizeof(sorted[0]));
+	double *thresholds = calloc(npairs, sizeof(thresholds[0]));
+	size_t *parent = calloc(ncpus, sizeof(parent[0]));
+	size_t *node = calloc(ncpus, sizeof(node[0]));
+	size_t n = 0, nlevels = 0;
+
+	for (size_t i = 0; i < ncpus; i++) {
+		for (size_t j = i + 1; j < ncpus; j++) {
+			sorted[n++] = LATENCY(i, j);
+		}
+	}
+	qsort(sorted, npairs, sizeof(sorted[0]), double_cmp);
+
+	for (size_t k = 0; k < npairs; k++) {
+		if (k + 1 < npairs && sorted[k + 1] <= sorted[k] * COREMAP_LEVEL_GAP) {
+			continue;
+		}
+		if (group_by(sorted[k], parent) == 1) {
+			break;
+		}
+		thresholds[nlevels++] = sorted[k];
+	}
+
+	printf("# level label max-ns group cpus...\n");
+
+	for (size_t level = 0; level < nlevels; level++) {
+		size_t maxsize = 0;
+
+		(void)group_by(thresholds[level], parent);
+		for (size_t i = 0; i < ncpus; i++) {
+			size_t size = 0;
+			for (size_t j = 0; j < ncpus; j++) {
+				size += (group_find(parent, j) == i);
+			}
+			maxsize = (size > maxsize) ? size : maxsize;
+		}
+
+		const char *label = "cluster";
+		if (level == 0 && maxsize <= 4) {
+			label = "smt";
+		} else if (level + 1 == nlevels) {
+			label = "socket";
+		}
+
+		size_t group = 0;
+		for (size_t i = 0; i < ncpus; i++) {
+			if (group_find(parent, i) != i) {
+				continue;
+			}
+			printf("%zu %s %.1f %zu", level, label, thresholds[level], group);
+			for (size_t j = 0; j < ncpus; j++) {
+				if (group_find(parent, j) == i) {
+					printf(" %d", cpus[j]);
+					node[j] = group;
+				}
+			}
+			printf("\n");
+			group++;
+		}
+	}
+
+	/* The coarsest level makes the fake NUMA node map */
+	printf("# node cpu node-id\n");
+	for (size_t i = 0; i < ncpus; i++) {
+		printf("node %d %zu\n", cpus[i], node[i]);
+	}
+
+	free(node);
+	free(parent);
+	free(thresholds);
+	free(sorted);
+}
+
+void
+usage(int argc [[maybe_unused]], char **argv) {
+	fprintf(stderr, "usage: %s [<iterations> [<samples> [<csv|heatmap|groups>]]]\n", argv[0]);
+}
+
+int
+main(int argc, char **argv) {
+	uint64_t iterations = 5000;
+	uint64_t samples = 3;
+	enum format format = FORMAT_CSV;
+	cpu_set_t set;
+
+	if (argc > 1) {
+		iterations = atoll(argv[1]);
+	}
+	if (argc > 2) {
+		samples = atoll(argv[2]);
+	}
+	if (argc > 3) {
+		if (strcmp(argv[3], "csv") == 0) {
+			format = FORMAT_CSV;
+		} else if (strcmp(argv[3], "heatmap") == 0) {
+			format = FORMAT_HEATMAP;
+		} else if (strcmp(argv[3], "groups") == 0) {
+			format = FORMAT_GROUPS;
+		} else {
+			usage(argc, argv);
+			exit(1);
+		}
+	}
+	if (iterations == 0 || samples == 0) {
+		usage(argc, argv);
+		exit(1);
+	}
+
+	int r = sched_getaffinity(0, sizeof(set), &set);
+	assert(r == 0);
+
+	cpus = calloc(CPU_COUNT(&set), sizeof(cpus[0]));
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &set)) {
+			cpus[ncpus++] = cpu;
+		}
+	}
+	if (ncpus < 2) {
+		fprintf(stderr, "at least two usable CPUs are needed\n");
+		exit(1);
+	}
+
+	matrix = calloc(ncpus * ncpus, sizeof(matrix[0]));
+
+	for (size_t i = 0; i < ncpus; i++) {
+		for (size_t j = i + 1; j < ncpus; j++) {
+			double latency = measure_pair(cpus[i], cpus[j], iterations, samples);
+			LATENCY(i, j) = latency;
+			LATENCY(j, i) = latency;
+		}
+	}
+
+	switch (format) {
+	case FORMAT_CSV:
+		print_csv();
+		break;
+	case FORMAT_HEATMAP:
+		print_heatmap();
+		break;
+	case FORMAT_GROUPS:
+		print_groups();
+		break;
+	}
+
+	free(matrix);
+	free(cpus);
+
+	return 0;
+}
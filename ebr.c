@@ -0,0 +1,207 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <uv.h>
+
+#include "atomic.h"
+#include "ebr.h"
+
+atomic_uint_fast64_t ebr_epoch = EBR_EPOCHS;
+thread_local struct ebr_thread *ebr_self = NULL;
+
+static _Atomic(struct ebr_thread *) ebr_threads[EBR_MAX_THREADS];
+static atomic_size_t ebr_nthreads; /* High-water mark of the used slots */
+static thread_local size_t ebr_slot;
+
+static uv_once_t ebr_once = UV_ONCE_INIT;
+static uv_mutex_t ebr_orphans_lock;
+static struct ebr_head *ebr_orphans = NULL;
+
+static void
+ebr_initialize(void) {
+	int r = uv_mutex_init(&ebr_orphans_lock);
+	assert(r == 0);
+}
+
+static void
+ebr_reclaim(struct ebr_head *head) {
+	while (head != NULL) {
+		struct ebr_head *next = head->next;
+		head->func(head);
+		head = next;
+	}
+}
+
+/*
+ * The global epoch can advance from 'epoch' only when every thread inside
+ * a critical section has already observed 'epoch'.
+ */
+static bool
+ebr_try_advance(uint64_t epoch) {
+	size_t nthreads = atomic_load_acquire(&ebr_nthreads);
+
+	atomic_thread_fence(memory_order_seq_cst);
+
+	for (size_t i = 0; i < nthreads; i++) {
+		struct ebr_thread *thread = atomic_load_acquire(&ebr_threads[i]);
+		if (thread == NULL) {
+			continue;
+		}
+
+		uint64_t observed = atomic_load_relaxed(&thread->epoch);
+		if ((observed & 1) != 0 && (observed >> 1) != epoch) {
+			return (false);
+		}
+	}
+
+	/* Losing the race means somebody else has advanced the epoch */
+	(void)atomic_compare_exchange_strong(&ebr_epoch, &epoch, epoch + 1);
+
+	return (true);
+}
+
+static void
+ebr_collect(struct ebr_thread *self, uint64_t epoch) {
+	for (size_t i = 0; i < EBR_EPOCHS; i++) {
+		struct ebr_limbo *limbo = &self->limbo[i];
+
+		if (limbo->head != NULL && limbo->epoch + 2 <= epoch) {
+			struct ebr_head *head = limbo->head;
+			limbo->head = NULL;
+			ebr_reclaim(head);
+		}
+	}
+}
+
+void
+ebr_register_thread(void) {
+	struct ebr_thread *thread = aligned_alloc(alignof(struct ebr_thread), sizeof(*thread));
+	*thread = (struct ebr_thread){ 0 };
+
+	uv_once(&ebr_once, ebr_initialize);
+
+	for (size_t i = 0; i < EBR_MAX_THREADS; i++) {
+		struct ebr_thread *expected = NULL;
+		if (atomic_compare_exchange_strong(&ebr_threads[i], &expected, thread)) {
+			size_t nthreads = atomic_load_relaxed(&ebr_nthreads);
+			while (nthreads < i + 1 &&
+			       !atomic_compare_exchange_weak(&ebr_nthreads, &nthreads, i + 1)) {
+			}
+
+			ebr_self = thread;
+			ebr_slot = i;
+			return;
+		}
+	}
+
+	fprintf(stderr, "too many EBR threads, raise EBR_MAX_THREADS (%d)\n", EBR_MAX_THREADS);
+	abort();
+}
+
+void
+ebr_unregister_thread(void) {
+	struct ebr_thread *self = ebr_self;
+
+	assert(self != NULL);
+	assert(atomic_load_relaxed(&self->epoch) == 0);
+
+	atomic_store_release(&ebr_threads[ebr_slot], NULL);
+
+	ebr_collect(self, atomic_load_acquire(&ebr_epoch));
+
+	uv_mutex_lock(&ebr_orphans_lock);
+	for (size_t i = 0; i < EBR_EPOCHS; i++) {
+		struct ebr_head *head = self->limbo[i].head;
+		while (head != NULL) {
+			struct ebr_head *next = head->next;
+			head->next = ebr_orphans;
+			ebr_orphans = head;
+			head = next;
+		}
+	}
+	uv_mutex_unlock(&ebr_orphans_lock);
+
+	ebr_self = NULL;
+	free(self);
+}
+
+void
+ebr_retire(struct ebr_head *head, void (*func)(struct ebr_head *head)) {
+	struct ebr_thread *self = ebr_self;
+
+	assert(self != NULL);
+
+	/* The unlinking stores must not be reordered after the epoch load */
+	atomic_thread_fence(memory_order_seq_cst);
+	uint64_t epoch = atomic_load_relaxed(&ebr_epoch);
+
+	/*
+	 * The limbo list for this epoch still holds memory from three (or
+	 * more) epochs ago, which is safe to free now.
+	 */
+	struct ebr_limbo *limbo = &self->limbo[epoch % EBR_EPOCHS];
+	if (limbo->head != NULL && limbo->epoch != epoch) {
+		struct ebr_head *old = limbo->head;
+		limbo->head = NULL;
+		ebr_reclaim(old);
+	}
+
+	head->func = func;
+	head->next = limbo->head;
+	limbo->head = head;
+	limbo->epoch = epoch;
+
+	if (++self->retired < EBR_BATCH) {
+		return;
+	}
+	self->retired = 0;
+
+	(void)ebr_try_advance(epoch);
+	ebr_collect(self, atomic_load_acquire(&ebr_epoch));
+}
+
+void
+ebr_synchronize(void) {
+	assert(ebr_self == NULL || atomic_load_relaxed(&ebr_self->epoch) == 0);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	uint64_t target = atomic_load_relaxed(&ebr_epoch) + 2;
+
+	for (;;) {
+		uint64_t epoch = atomic_load_acquire(&ebr_epoch);
+		if (epoch >= target) {
+			break;
+		}
+		if (!ebr_try_advance(epoch)) {
+			(void)sched_yield();
+		}
+	}
+}
+
+void
+ebr_barrier(void) {
+	uv_once(&ebr_once, ebr_initialize);
+
+	ebr_synchronize();
+
+	uv_mutex_lock(&ebr_orphans_lock);
+	struct ebr_head *head = ebr_orphans;
+	ebr_orphans = NULL;
+	uv_mutex_unlock(&ebr_orphans_lock);
+
+	ebr_reclaim(head);
+}
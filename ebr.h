@@ -0,0 +1,115 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file ebr.h
+ * Epoch-based memory reclamation.
+ *
+ * Every registered thread announces the global epoch it has observed when
+ * it enters a read-side critical section.  The global epoch can advance
+ * only when all the threads inside a critical section have observed it,
+ * so memory retired in epoch 'e' can't be reached by any reader once the
+ * global epoch is 'e + 2'.
+ *
+ * Retired memory is kept in per-thread limbo lists, one for each of the
+ * last three epochs, and it is freed by the retiring thread itself: every
+ * EBR_BATCH retirements it tries to advance the global epoch and frees
+ * the limbo lists that became safe.  There's no background thread and no
+ * memory is ever freed by a thread other than the one that retired it,
+ * except for the leftovers of exited threads freed by ebr_barrier().
+ */
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+#include "atomic.h"
+
+#ifndef EBR_MAX_THREADS
+#define EBR_MAX_THREADS 1024
+#endif /* ifndef EBR_MAX_THREADS */
+
+/*
+ * Number of retirements between two attempts to advance the epoch.
+ */
+#ifndef EBR_BATCH
+#define EBR_BATCH 64
+#endif /* ifndef EBR_BATCH */
+
+#define EBR_EPOCHS 3
+
+struct ebr_head {
+	struct ebr_head *next;
+	void (*func)(struct ebr_head *head);
+};
+
+struct ebr_limbo {
+	struct ebr_head *head;
+	uint64_t epoch; /*%< The epoch the retired memory belongs to */
+};
+
+struct ebr_thread {
+	alignas(64) atomic_uint_fast64_t epoch; /*%< (observed epoch << 1) | active */
+	alignas(64) struct ebr_limbo limbo[EBR_EPOCHS];
+	size_t retired; /*%< Retirements since the last advance attempt */
+};
+
+extern atomic_uint_fast64_t ebr_epoch;
+extern thread_local struct ebr_thread *ebr_self;
+
+void
+ebr_register_thread(void);
+/*%<
+ * Register the calling thread, it has to be registered before it enters
+ * a read-side critical section or retires any memory.
+ */
+
+void
+ebr_unregister_thread(void);
+/*%<
+ * Unregister the calling thread, the memory it has retired and that is
+ * not safe to free yet is handed over to ebr_barrier().
+ */
+
+static inline void
+ebr_read_lock(void) {
+	uint64_t epoch = atomic_load_relaxed(&ebr_epoch);
+
+	atomic_store_relaxed(&ebr_self->epoch, (epoch << 1) | 1);
+	/* The announcement must be visible before we read anything */
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void
+ebr_read_unlock(void) {
+	atomic_store_release(&ebr_self->epoch, 0);
+}
+
+void
+ebr_retire(struct ebr_head *head, void (*func)(struct ebr_head *head));
+/*%<
+ * Call 'func' on 'head' when no reader can reach it anymore.  The memory
+ * must already be unreachable for new readers.  Must be called outside of
+ * a read-side critical section.
+ */
+
+void
+ebr_synchronize(void);
+/*%<
+ * Wait until all the readers that might still see memory retired before
+ * the call have left their critical sections.
+ */
+
+void
+ebr_barrier(void);
+/*%<
+ * Free all the memory retired by the threads that have already
+ * unregistered.
+ */
@@ -0,0 +1,163 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include "atomic.h"
+#include "elimstack.h"
+#include "util.h"
+
+/*
+ * A slot is empty, holds the node of a waiting push, or is taken by a pop
+ * until the push notices and empties the slot again.  Only the push that
+ * owns the slot empties it, so a slot can't go from one node to another
+ * behind the back of the waiting push.
+ */
+#define ELIMSTACK_EMPTY NULL
+#define ELIMSTACK_TAKEN ((struct elimstack_node *)1)
+
+struct elimstack_slot {
+	alignas(64) struct elimstack_node *_Atomic node;
+};
+
+struct elimstack {
+	alignas(64) struct elimstack_node *_Atomic top;
+	struct elimstack_slot slots[ELIMSTACK_SLOTS];
+};
+
+static thread_local size_t elimstack_range = 1;
+static thread_local bool elimstack_seeded = false;
+
+static struct elimstack_slot *
+elimstack_slot(struct elimstack *stack) {
+	if (!elimstack_seeded) {
+		random_init();
+		elimstack_seeded = true;
+	}
+
+	return (&stack->slots[next() % elimstack_range]);
+}
+
+/*
+ * Offer the node to a pop in a random slot, true when a pop has taken it.
+ */
+static bool
+elimstack_offer(struct elimstack *stack, struct elimstack_node *node) {
+	struct elimstack_slot *slot = elimstack_slot(stack);
+	struct elimstack_node *expected = ELIMSTACK_EMPTY;
+
+	if (!atomic_compare_exchange_strong_acq_rel(&slot->node, &expected, node)) {
+		/* Busy, spread out */
+		if (elimstack_range < ELIMSTACK_SLOTS) {
+			elimstack_range *= 2;
+		}
+		return (false);
+	}
+
+	for (size_t i = 0; i < ELIMSTACK_SPINS; i++) {
+		if (atomic_load_acquire(&slot->node) == ELIMSTACK_TAKEN) {
+			atomic_store_release(&slot->node, ELIMSTACK_EMPTY);
+			return (true);
+		}
+		pause();
+	}
+
+	expected = node;
+	if (atomic_compare_exchange_strong_acq_rel(&slot->node, &expected, ELIMSTACK_EMPTY)) {
+		/* Nobody came, move closer together */
+		if (elimstack_range > 1) {
+			elimstack_range /= 2;
+		}
+		return (false);
+	}
+
+	/* A pop took the node after all */
+	atomic_store_release(&slot->node, ELIMSTACK_EMPTY);
+
+	return (true);
+}
+
+/*
+ * Take the node of a waiting push from a random slot.
+ */
+static struct elimstack_node *
+elimstack_take(struct elimstack *stack) {
+	struct elimstack_slot *slot = elimstack_slot(stack);
+	struct elimstack_node *node = atomic_load_acquire(&slot->node);
+
+	if (node == ELIMSTACK_EMPTY || node == ELIMSTACK_TAKEN) {
+		return (NULL);
+	}
+
+	if (!atomic_compare_exchange_strong_acq_rel(&slot->node, &node, ELIMSTACK_TAKEN)) {
+		return (NULL);
+	}
+
+	return (node);
+}
+
+struct elimstack *
+elimstack_new(void) {
+	struct elimstack *stack = aligned_alloc(alignof(struct elimstack), sizeof(*stack));
+
+	atomic_init(&stack->top, NULL);
+	for (size_t i = 0; i < ELIMSTACK_SLOTS; i++) {
+		atomic_init(&stack->slots[i].node, ELIMSTACK_EMPTY);
+	}
+
+	return (stack);
+}
+
+void
+elimstack_destroy(struct elimstack *stack) {
+	free(stack);
+}
+
+void
+elimstack_push(struct elimstack *stack, struct elimstack_node *node) {
+	for (;;) {
+		struct elimstack_node *top = atomic_load_relaxed(&stack->top);
+
+		atomic_store_relaxed(&node->next, top);
+		if (atomic_compare_exchange_strong_acq_rel(&stack->top, &top, node)) {
+			return;
+		}
+
+		if (elimstack_offer(stack, node)) {
+			return;
+		}
+	}
+}
+
+struct elimstack_node *
+elimstack_pop(struct elimstack *stack) {
+	for (;;) {
+		struct elimstack_node *top = atomic_load_acquire(&stack->top);
+
+		if (top == NULL) {
+			return (NULL);
+		}
+
+		struct elimstack_node *next = atomic_load_relaxed(&top->next);
+		if (atomic_compare_exchange_strong_acq_rel(&stack->top, &top, next)) {
+			return (top);
+		}
+
+		struct elimstack_node *node = elimstack_take(stack);
+		if (node != NULL) {
+			return (node);
+		}
+	}
+}
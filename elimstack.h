@@ -0,0 +1,62 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file elimstack.h
+ * Elimination-backoff stack (Hendler, Shavit, Yerushalmi: A Scalable
+ * Lock-free Stack Algorithm, SPAA 2004).
+ *
+ * The stack is a Treiber stack, and a push or a pop that loses the
+ * compare-and-swap on the top backs off into the elimination array
+ * instead of retrying right away.  A push waiting in a slot of the array
+ * hands its node straight to a pop that lands on the same slot, and the
+ * pair completes without touching the top at all.  The more contended the
+ * top is, the more operations end up eliminated.
+ *
+ * Every thread adapts the part of the array it uses: the range shrinks
+ * when a push has waited in vain and grows when the chosen slot is taken.
+ *
+ * The stack is intrusive and doesn't free the nodes.  Like __cds_lfs_pop(),
+ * elimstack_pop() dereferences the top node, so the nodes must not be
+ * freed or reused while another thread might still be popping, e.g. the
+ * pops run inside an RCU read-side critical section and the nodes are
+ * freed with call_rcu().
+ */
+
+#include <stdatomic.h>
+
+#ifndef ELIMSTACK_SLOTS
+#define ELIMSTACK_SLOTS 16 /*%< The size of the elimination array */
+#endif /* ifndef ELIMSTACK_SLOTS */
+
+#ifndef ELIMSTACK_SPINS
+#define ELIMSTACK_SPINS 32 /*%< How long a push waits in the array for a pop */
+#endif /* ifndef ELIMSTACK_SPINS */
+
+struct elimstack_node {
+	struct elimstack_node *_Atomic next;
+};
+
+struct elimstack;
+
+struct elimstack *
+elimstack_new(void);
+
+void
+elimstack_destroy(struct elimstack *stack);
+/*%<
+ * Free the stack, the nodes still on the stack are not freed.
+ */
+
+void
+elimstack_push(struct elimstack *stack, struct elimstack_node *node);
+
+struct elimstack_node *
+elimstack_pop(struct elimstack *stack);
+/*%<
+ * Pop the newest node, NULL when the stack is empty.
+ */
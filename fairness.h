@@ -0,0 +1,110 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file fairness.h
+ * Per-thread fairness and starvation tracking.
+ *
+ * When enabled, every operation is timed and the longest read and write
+ * operation of each thread is kept.  Operations that take longer than the
+ * starvation threshold are counted as starvation events.  The per-thread
+ * throughputs are summarized as min/median/max and Jain's fairness index
+ * (1.0 is perfectly fair, 1/n means a single thread did all the work).
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "phase.h"
+
+struct fairness {
+	uint64_t longest_read;	/*%< Longest read op in ns */
+	uint64_t longest_write; /*%< Longest write op in ns */
+	uint64_t starved_reads;
+	uint64_t starved_writes;
+};
+
+static bool fairness_enabled = false;
+static uint64_t fairness_threshold = 1000 * 1000; /* 1 ms */
+
+static inline uint64_t
+fairness_begin(void) {
+	return (fairness_enabled ? phase_now() : 0);
+}
+
+static inline void
+fairness_end(struct fairness *fairness, uint64_t begin, bool write) {
+	if (!fairness_enabled) {
+		return;
+	}
+
+	uint64_t wait = phase_now() - begin;
+	if (write) {
+		fairness->longest_write = (wait > fairness->longest_write) ? wait : fairness->longest_write;
+		fairness->starved_writes += (wait > fairness_threshold);
+	} else {
+		fairness->longest_read = (wait > fairness->longest_read) ? wait : fairness->longest_read;
+		fairness->starved_reads += (wait > fairness_threshold);
+	}
+}
+
+static inline int
+fairness_cmp(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return ((x > y) - (x < y));
+}
+
+static inline void
+fairness_print_header(void) {
+	printf("| %10s | %10s | %10s | %10s | %10s | %10s ", "min op/s", "median", "max op/s", "jain",
+	       "max wait", "starved");
+}
+
+/*
+ * Print the summary columns for 'n' threads with per-thread throughputs
+ * 'ops_per_sec', and report every thread that hit the starvation threshold
+ * on stderr, prefixed with 'name'.
+ */
+static inline void
+fairness_print(const char *name, const double *ops_per_sec, const struct fairness *fairness, size_t n) {
+	double *sorted = calloc(n, sizeof(sorted[0]));
+	double sum = 0.0, sum2 = 0.0;
+	uint64_t longest = 0, starved = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		sorted[i] = ops_per_sec[i];
+		sum += ops_per_sec[i];
+		sum2 += ops_per_sec[i] * ops_per_sec[i];
+
+		uint64_t l = (fairness[i].longest_read > fairness[i].longest_write) ? fairness[i].longest_read
+										     : fairness[i].longest_write;
+		longest = (l > longest) ? l : longest;
+		starved += fairness[i].starved_reads + fairness[i].starved_writes;
+	}
+	qsort(sorted, n, sizeof(sorted[0]), fairness_cmp);
+
+	printf("| %10.0f | %10.0f | %10.0f | %10.4f | %8.3fms | %10" PRIu64 " ", sorted[0], sorted[n / 2],
+	       sorted[n - 1], (sum2 > 0.0) ? (sum * sum) / (n * sum2) : 1.0, (double)longest / 1000000, starved);
+
+	for (size_t i = 0; i < n; i++) {
+		if (fairness[i].starved_writes > 0) {
+			fprintf(stderr, "%s: thread %zu starved %" PRIu64 " writes, longest %.3f ms\n", name, i,
+				fairness[i].starved_writes, (double)fairness[i].longest_write / 1000000);
+		}
+		if (fairness[i].starved_reads > 0) {
+			fprintf(stderr, "%s: thread %zu starved %" PRIu64 " reads, longest %.3f ms\n", name, i,
+				fairness[i].starved_reads, (double)fairness[i].longest_read / 1000000);
+		}
+	}
+
+	free(sorted);
+}
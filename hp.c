@@ -0,0 +1,191 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <uv.h>
+
+#include "atomic.h"
+#include "hp.h"
+
+thread_local struct hp_thread *hp_self = NULL;
+
+static _Atomic(struct hp_thread *) hp_threads[HP_MAX_THREADS];
+static atomic_size_t hp_nthreads; /* High-water mark of the used slots */
+static thread_local size_t hp_slot;
+
+static uv_once_t hp_once = UV_ONCE_INIT;
+static uv_mutex_t hp_orphans_lock;
+static struct hp_head *hp_orphans = NULL;
+
+static void
+hp_initialize(void) {
+	int r = uv_mutex_init(&hp_orphans_lock);
+	assert(r == 0);
+}
+
+static int
+hp_cmp(const void *a, const void *b) {
+	uintptr_t x = (uintptr_t)*(void *const *)a, y = (uintptr_t)*(void *const *)b;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * Collect the hazard pointers of all threads into a sorted array.
+ */
+static size_t
+hp_collect(void **hazards) {
+	size_t nthreads = atomic_load_acquire(&hp_nthreads);
+	size_t n = 0;
+
+	atomic_thread_fence(memory_order_seq_cst);
+
+	for (size_t i = 0; i < nthreads; i++) {
+		struct hp_thread *thread = atomic_load_acquire(&hp_threads[i]);
+		if (thread == NULL) {
+			continue;
+		}
+		for (size_t j = 0; j < HP_SLOTS; j++) {
+			void *ptr = atomic_load_relaxed(&thread->slot[j]);
+			if (ptr != NULL) {
+				hazards[n++] = ptr;
+			}
+		}
+	}
+
+	qsort(hazards, n, sizeof(hazards[0]), hp_cmp);
+
+	return (n);
+}
+
+/*
+ * Free everything on the 'list' that is not protected and return the rest.
+ */
+static struct hp_head *
+hp_scan(struct hp_head *list, void **hazards, size_t *nretired) {
+	size_t nhazards = hp_collect(hazards);
+	struct hp_head *keep = NULL;
+
+	*nretired = 0;
+	while (list != NULL) {
+		struct hp_head *next = list->next;
+
+		if (bsearch(&list->ptr, hazards, nhazards, sizeof(hazards[0]), hp_cmp) != NULL) {
+			list->next = keep;
+			keep = list;
+			(*nretired)++;
+		} else {
+			list->func(list);
+		}
+
+		list = next;
+	}
+
+	return (keep);
+}
+
+static void
+hp_orphan(struct hp_head *list) {
+	uv_mutex_lock(&hp_orphans_lock);
+	while (list != NULL) {
+		struct hp_head *next = list->next;
+		list->next = hp_orphans;
+		hp_orphans = list;
+		list = next;
+	}
+	uv_mutex_unlock(&hp_orphans_lock);
+}
+
+void
+hp_register_thread(void) {
+	struct hp_thread *thread = aligned_alloc(alignof(struct hp_thread), sizeof(*thread));
+	*thread = (struct hp_thread){
+		.hazards = calloc(HP_MAX_THREADS * HP_SLOTS, sizeof(thread->hazards[0])),
+	};
+
+	uv_once(&hp_once, hp_initialize);
+
+	for (size_t i = 0; i < HP_MAX_THREADS; i++) {
+		struct hp_thread *expected = NULL;
+		if (atomic_compare_exchange_strong(&hp_threads[i], &expected, thread)) {
+			size_t nthreads = atomic_load_relaxed(&hp_nthreads);
+			while (nthreads < i + 1 &&
+			       !atomic_compare_exchange_weak(&hp_nthreads, &nthreads, i + 1)) {
+			}
+
+			hp_self = thread;
+			hp_slot = i;
+			return;
+		}
+	}
+
+	fprintf(stderr, "too many hazard pointer threads, raise HP_MAX_THREADS (%d)\n", HP_MAX_THREADS);
+	abort();
+}
+
+void
+hp_unregister_thread(void) {
+	struct hp_thread *self = hp_self;
+
+	assert(self != NULL);
+
+	hp_clear();
+	atomic_store_release(&hp_threads[hp_slot], NULL);
+
+	hp_orphan(hp_scan(self->retired, self->hazards, &self->nretired));
+
+	hp_self = NULL;
+	free(self->hazards);
+	free(self);
+}
+
+void
+hp_retire(struct hp_head *head, void *ptr, void (*func)(struct hp_head *head)) {
+	struct hp_thread *self = hp_self;
+
+	assert(self != NULL);
+
+	head->ptr = ptr;
+	head->func = func;
+	head->next = self->retired;
+	self->retired = head;
+	self->nretired++;
+
+	size_t threshold = 2 * HP_SLOTS * atomic_load_relaxed(&hp_nthreads);
+	if (self->nretired < threshold || self->nretired < HP_BATCH) {
+		return;
+	}
+
+	self->retired = hp_scan(self->retired, self->hazards, &self->nretired);
+}
+
+void
+hp_barrier(void) {
+	uv_once(&hp_once, hp_initialize);
+
+	uv_mutex_lock(&hp_orphans_lock);
+	struct hp_head *list = hp_orphans;
+	hp_orphans = NULL;
+	uv_mutex_unlock(&hp_orphans_lock);
+
+	if (list == NULL) {
+		return;
+	}
+
+	void **hazards = calloc(HP_MAX_THREADS * HP_SLOTS, sizeof(hazards[0]));
+	size_t nkept;
+	hp_orphan(hp_scan(list, hazards, &nkept));
+	free(hazards);
+}
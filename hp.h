@@ -0,0 +1,120 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file hp.h
+ * Hazard-pointer memory reclamation.
+ *
+ * Every registered thread owns HP_SLOTS hazard pointers.  Before a thread
+ * dereferences a shared pointer it publishes it in one of its slots with
+ * hp_protect(), which also validates that the pointer is still reachable.
+ * Retired memory is kept in a per-thread retire list, and once the list
+ * grows over the scan threshold the thread collects the hazard pointers
+ * of all threads and frees everything that is not protected.
+ *
+ * Unlike RCU and EBR, a stalled thread can pin at most HP_SLOTS objects,
+ * so the unreclaimed memory is bounded by the number of threads times the
+ * scan threshold.
+ */
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+#include "atomic.h"
+
+#ifndef HP_MAX_THREADS
+#define HP_MAX_THREADS 1024
+#endif /* ifndef HP_MAX_THREADS */
+
+#ifndef HP_SLOTS
+#define HP_SLOTS 2
+#endif /* ifndef HP_SLOTS */
+
+/*
+ * The retire list is scanned when it's longer than twice the number of
+ * hazard pointers in use, but never more often than every HP_BATCH
+ * retirements.
+ */
+#ifndef HP_BATCH
+#define HP_BATCH 64
+#endif /* ifndef HP_BATCH */
+
+struct hp_head {
+	struct hp_head *next;
+	void *ptr; /*%< The pointer the hazard pointers protect */
+	void (*func)(struct hp_head *head);
+};
+
+struct hp_thread {
+	alignas(64) void *_Atomic slot[HP_SLOTS];
+	alignas(64) struct hp_head *retired;
+	size_t nretired;
+	void **hazards; /*%< Scratch space for the scan */
+};
+
+extern thread_local struct hp_thread *hp_self;
+
+void
+hp_register_thread(void);
+/*%<
+ * Register the calling thread, it has to be registered before it uses
+ * any hazard pointer or retires any memory.
+ */
+
+void
+hp_unregister_thread(void);
+/*%<
+ * Unregister the calling thread, the memory it has retired and that is
+ * still protected is handed over to hp_barrier().
+ */
+
+/*
+ * Load the pointer from 'src' and protect it with the hazard pointer
+ * 'slot'.  The returned pointer can be dereferenced until the slot is
+ * cleared or reused.
+ */
+static inline void *
+hp_protect(size_t slot, void *_Atomic *src) {
+	void *ptr = atomic_load_relaxed(src);
+
+	for (;;) {
+		atomic_store_relaxed(&hp_self->slot[slot], ptr);
+		/* The hazard pointer must be visible before we validate it */
+		atomic_thread_fence(memory_order_seq_cst);
+
+		void *again = atomic_load_acquire(src);
+		if (again == ptr) {
+			return (ptr);
+		}
+		ptr = again;
+	}
+}
+
+static inline void
+hp_clear(void) {
+	for (size_t i = 0; i < HP_SLOTS; i++) {
+		atomic_store_release(&hp_self->slot[i], NULL);
+	}
+}
+
+void
+hp_retire(struct hp_head *head, void *ptr, void (*func)(struct hp_head *head));
+/*%<
+ * Call 'func' on 'head' when 'ptr' is not protected by any hazard pointer.
+ * The memory must already be unreachable for new readers.
+ */
+
+void
+hp_barrier(void);
+/*%<
+ * Free all the memory retired by the threads that have already
+ * unregistered and is not protected anymore.
+ */
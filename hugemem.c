@@ -0,0 +1,278 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "atomic.h"
+#include "hugemem.h"
+
+#define MIB (1024.0 * 1024.0)
+
+static const char *hugemem_names[] = {
+	[HUGEMEM_OFF] = "off",
+	[HUGEMEM_THP] = "thp",
+	[HUGEMEM_HUGETLB] = "hugetlb",
+};
+
+static enum hugemem_mode hugemem_mode = HUGEMEM_OFF;
+static bool hugemem_prefault = false;
+static bool hugemem_lock = false;
+
+/*
+ * The best mode that any mapping actually got, the mappings are made by
+ * the prefill threads concurrently.
+ */
+static atomic_int hugemem_got = HUGEMEM_OFF;
+static atomic_bool hugemem_fallback = false;
+
+static uv_once_t hugemem_once = UV_ONCE_INIT;
+static uv_mutex_t hugemem_chunks_lock;
+static uint8_t *hugemem_chunk = NULL;
+static size_t hugemem_offset = HUGEMEM_CHUNK;
+
+/* Chunks mapped by hugemem_reserve() and not used yet */
+struct hugemem_free_chunk {
+	struct hugemem_free_chunk *next;
+};
+static struct hugemem_free_chunk *hugemem_reserved = NULL;
+
+static void
+hugemem_initialize(void) {
+	int r = uv_mutex_init(&hugemem_chunks_lock);
+	assert(r == 0);
+}
+
+bool
+hugemem_set(const char *name) {
+	for (size_t i = 0; i < sizeof(hugemem_names) / sizeof(hugemem_names[0]); i++) {
+		if (strcmp(name, hugemem_names[i]) == 0) {
+			hugemem_mode = i;
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+void
+hugemem_options(bool prefault, bool lock) {
+	hugemem_prefault = prefault;
+	hugemem_lock = lock;
+}
+
+bool
+hugemem_enabled(void) {
+	return (hugemem_mode != HUGEMEM_OFF || hugemem_prefault || hugemem_lock);
+}
+
+static size_t
+hugemem_round(size_t size) {
+	return ((size + HUGEMEM_CHUNK - 1) & ~(size_t)(HUGEMEM_CHUNK - 1));
+}
+
+static void
+hugemem_touch(uint8_t *ptr, size_t size) {
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	for (size_t off = 0; off < size; off += pagesize) {
+		((volatile uint8_t *)ptr)[off] = 0;
+	}
+
+	if (hugemem_lock && mlock(ptr, size) != 0) {
+		static atomic_bool warned = false;
+		if (!atomic_exchange_relaxed(&warned, true)) {
+			fprintf(stderr, "mlock() failed: %s, check ulimit -l\n", strerror(errno));
+		}
+	}
+}
+
+static void
+hugemem_got_mode(enum hugemem_mode mode) {
+	int got = atomic_load_relaxed(&hugemem_got);
+
+	while (got < (int)mode && !atomic_compare_exchange_weak_relaxed(&hugemem_got, &got, mode)) {
+	}
+}
+
+/*
+ * Map 'size' bytes (a multiple of HUGEMEM_CHUNK) aligned to HUGEMEM_CHUNK.
+ */
+static uint8_t *
+hugemem_map(size_t size) {
+	uint8_t *ptr = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+	if (hugemem_mode == HUGEMEM_HUGETLB) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			hugemem_got_mode(HUGEMEM_HUGETLB);
+		} else {
+			atomic_store_relaxed(&hugemem_fallback, true);
+		}
+	}
+#endif /* if defined(MAP_HUGETLB) */
+
+	if (ptr == MAP_FAILED) {
+		/* Over-allocate and trim to get a chunk-aligned mapping */
+		uint8_t *raw = mmap(NULL, size + HUGEMEM_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+				    -1, 0);
+		assert(raw != MAP_FAILED);
+
+		ptr = (uint8_t *)(((uintptr_t)raw + HUGEMEM_CHUNK - 1) & ~(uintptr_t)(HUGEMEM_CHUNK - 1));
+		if (ptr > raw) {
+			(void)munmap(raw, ptr - raw);
+		}
+		(void)munmap(ptr + size, raw + HUGEMEM_CHUNK - ptr);
+
+#if defined(MADV_HUGEPAGE)
+		if (hugemem_mode != HUGEMEM_OFF) {
+			if (madvise(ptr, size, MADV_HUGEPAGE) == 0) {
+				hugemem_got_mode(HUGEMEM_THP);
+			} else {
+				atomic_store_relaxed(&hugemem_fallback, true);
+			}
+		}
+#else  /* if defined(MADV_HUGEPAGE) */
+		if (hugemem_mode != HUGEMEM_OFF) {
+			atomic_store_relaxed(&hugemem_fallback, true);
+		}
+#endif /* if defined(MADV_HUGEPAGE) */
+	}
+
+	if (hugemem_prefault || hugemem_lock) {
+		hugemem_touch(ptr, size);
+	}
+
+	return (ptr);
+}
+
+void *
+hugemem_alloc(size_t size) {
+	if (!hugemem_enabled()) {
+		return (calloc(1, size));
+	}
+
+	/* Fresh anonymous mappings are zeroed */
+	return (hugemem_map(hugemem_round(size)));
+}
+
+void
+hugemem_free(void *ptr, size_t size) {
+	if (!hugemem_enabled()) {
+		free(ptr);
+		return;
+	}
+
+	(void)munmap(ptr, hugemem_round(size));
+}
+
+void *
+hugemem_slab(size_t size) {
+	assert(size <= HUGEMEM_CHUNK && HUGEMEM_CHUNK % size == 0);
+
+	if (!hugemem_enabled()) {
+		return (aligned_alloc(size, size));
+	}
+
+	uv_once(&hugemem_once, hugemem_initialize);
+
+	uv_mutex_lock(&hugemem_chunks_lock);
+	if (hugemem_offset + size > HUGEMEM_CHUNK) {
+		if (hugemem_reserved != NULL) {
+			hugemem_chunk = (uint8_t *)hugemem_reserved;
+			hugemem_reserved = hugemem_reserved->next;
+		} else {
+			hugemem_chunk = hugemem_map(HUGEMEM_CHUNK);
+		}
+		hugemem_offset = 0;
+	}
+	void *slab = hugemem_chunk + hugemem_offset;
+	hugemem_offset += size;
+	uv_mutex_unlock(&hugemem_chunks_lock);
+
+	return (slab);
+}
+
+void
+hugemem_reserve(size_t size) {
+	if (!hugemem_enabled()) {
+		return;
+	}
+
+	uv_once(&hugemem_once, hugemem_initialize);
+
+	size = hugemem_round(size);
+	uint8_t *ptr = hugemem_map(size);
+
+	uv_mutex_lock(&hugemem_chunks_lock);
+	for (size_t off = size; off > 0; off -= HUGEMEM_CHUNK) {
+		struct hugemem_free_chunk *chunk = (struct hugemem_free_chunk *)(ptr + off - HUGEMEM_CHUNK);
+		chunk->next = hugemem_reserved;
+		hugemem_reserved = chunk;
+	}
+	uv_mutex_unlock(&hugemem_chunks_lock);
+}
+
+static bool
+hugemem_read(size_t *huge) {
+	FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+	char line[256];
+	bool found = false;
+
+	if (fp == NULL) {
+		return (false);
+	}
+
+	*huge = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		size_t kb;
+		if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1 ||
+		    sscanf(line, "Private_Hugetlb: %zu kB", &kb) == 1)
+		{
+			*huge += kb * 1024;
+			found = true;
+		}
+	}
+	fclose(fp);
+
+	return (found);
+}
+
+void
+hugemem_print_header(void) {
+	printf("| %10s | %10s ", "pages", "huge");
+}
+
+void
+hugemem_print(void) {
+	size_t huge;
+	char pages[16];
+
+	(void)snprintf(pages, sizeof(pages), "%s%s", hugemem_names[atomic_load_relaxed(&hugemem_got)],
+		       atomic_load_relaxed(&hugemem_fallback) ? "*" : "");
+	printf("| %10s ", pages);
+
+	if (!hugemem_read(&huge)) {
+		printf("| %10s ", "-");
+		return;
+	}
+	printf("| %7.1fMiB ", (double)huge / MIB);
+}
@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file hugemem.h
+ * Huge-page backed and pre-faulted memory for the op arrays and the slabs
+ * of the node pools.
+ *
+ * With huge pages enabled the memory is mapped with MAP_HUGETLB, falling
+ * back to transparent huge pages via madvise(MADV_HUGEPAGE) when there
+ * are no reserved huge pages, and to normal pages when THP is disabled.
+ * The slabs of the pool and mctx allocators are carved from HUGEMEM_CHUNK
+ * chunks; hugemem_reserve() maps and pre-faults (and optionally locks)
+ * enough chunks before the measured run, so neither the TLB misses of the
+ * small pages nor the first-touch page faults end up in the measurement.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HUGEMEM_CHUNK (2 * 1024 * 1024)
+
+enum hugemem_mode {
+	HUGEMEM_OFF = 0, /*%< Normal pages */
+	HUGEMEM_THP,	 /*%< Transparent huge pages */
+	HUGEMEM_HUGETLB, /*%< Reserved huge pages, THP as the fallback */
+};
+
+bool
+hugemem_set(const char *name);
+/*%<
+ * Select the mode by name ("off", "thp" or "hugetlb"), false if there's
+ * no such mode.
+ */
+
+void
+hugemem_options(bool prefault, bool lock);
+/*%<
+ * Pre-fault the memory when it's mapped and lock it in memory with
+ * mlock(2).
+ */
+
+bool
+hugemem_enabled(void);
+/*%<
+ * True when huge pages or pre-faulting were requested.
+ */
+
+void *
+hugemem_alloc(size_t size);
+/*%<
+ * Allocate zeroed memory for an op array.
+ */
+
+void
+hugemem_free(void *ptr, size_t size);
+
+void *
+hugemem_slab(size_t size);
+/*%<
+ * Allocate a slab aligned to its 'size', which must be a power of two
+ * that divides HUGEMEM_CHUNK.  The slabs are never freed.
+ */
+
+void
+hugemem_reserve(size_t size);
+/*%<
+ * Map and pre-fault enough chunks for 'size' bytes of slabs.
+ */
+
+void
+hugemem_print_header(void);
+
+void
+hugemem_print(void);
+/*%<
+ * Print the page size the memory actually got, marked with '*' when some
+ * mapping had to fall back, and the amount of memory in huge pages of the
+ * whole process.
+ */
@@ -0,0 +1,269 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#ifndef _LGPL_SOURCE
+#define _LGPL_SOURCE 1
+#endif
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+#include "lcrq.h"
+#include "rcu.h"
+
+#if HAVE_LCRQ
+
+#define CRQ_CLOSED (UINT64_C(1) << 63) /* In the tail */
+#define CRQ_SAFE   (UINT64_C(1) << 63) /* In the cell index */
+#define CRQ_EMPTY  0
+
+/*
+ * Every cell gets its own cache line, the neighbouring cells are taken by
+ * different threads at the same time.
+ */
+struct crq_cell {
+	alignas(64) uint64_t idx; /* The round index and the safe bit */
+	uint64_t val;
+};
+
+union crq_pair {
+	unsigned __int128 full;
+	struct {
+		uint64_t idx;
+		uint64_t val;
+	} half;
+};
+
+struct crq {
+	alignas(64) atomic_uint_fast64_t head;
+	alignas(64) atomic_uint_fast64_t tail;
+	alignas(64) _Atomic(struct crq *) next;
+	struct rcu_head rcu_head;
+	struct crq_cell ring[CRQ_SIZE];
+};
+
+struct lcrq {
+	alignas(64) _Atomic(struct crq *) head;
+	alignas(64) _Atomic(struct crq *) tail;
+};
+
+static bool
+crq_cas2(struct crq_cell *cell, uint64_t idx, uint64_t val, uint64_t nidx, uint64_t nval) {
+	union crq_pair old = { .half = { idx, val } };
+	union crq_pair new = { .half = { nidx, nval } };
+
+	return (__sync_bool_compare_and_swap((unsigned __int128 *)cell, old.full, new.full));
+}
+
+static struct crq *
+crq_new(void *first) {
+	struct crq *crq = aligned_alloc(alignof(struct crq), sizeof(*crq));
+
+	atomic_init(&crq->head, 0);
+	atomic_init(&crq->tail, 0);
+	atomic_init(&crq->next, NULL);
+
+	for (size_t i = 0; i < CRQ_SIZE; i++) {
+		crq->ring[i].idx = CRQ_SAFE | i;
+		crq->ring[i].val = CRQ_EMPTY;
+	}
+
+	if (first != NULL) {
+		crq->ring[0].val = (uintptr_t)first;
+		atomic_init(&crq->tail, 1);
+	}
+
+	return (crq);
+}
+
+static void
+crq_free_rcu(struct rcu_head *rcu_head) {
+	free(caa_container_of(rcu_head, struct crq, rcu_head));
+}
+
+static bool
+crq_enqueue(struct crq *crq, void *ptr) {
+	for (size_t tries = 0;; tries++) {
+		uint64_t t = atomic_fetch_add(&crq->tail, 1);
+		if ((t & CRQ_CLOSED) != 0) {
+			return (false);
+		}
+
+		struct crq_cell *cell = &crq->ring[t & (CRQ_SIZE - 1)];
+		uint64_t idx = __atomic_load_n(&cell->idx, __ATOMIC_ACQUIRE);
+		uint64_t val = __atomic_load_n(&cell->val, __ATOMIC_ACQUIRE);
+
+		/*
+		 * An unsafe cell has been skipped by a consumer of a later
+		 * round, it's usable only if no consumer can be waiting for it.
+		 */
+		if (val == CRQ_EMPTY && (idx & ~CRQ_SAFE) <= t &&
+		    ((idx & CRQ_SAFE) != 0 || atomic_load(&crq->head) <= t) &&
+		    crq_cas2(cell, idx, CRQ_EMPTY, CRQ_SAFE | t, (uintptr_t)ptr))
+		{
+			return (true);
+		}
+
+		uint64_t h = atomic_load(&crq->head);
+		if ((int64_t)(t - h) >= CRQ_SIZE || tries >= CRQ_STARVATION) {
+			(void)atomic_fetch_or(&crq->tail, CRQ_CLOSED);
+			return (false);
+		}
+	}
+}
+
+/*
+ * Move the tail past the head when the consumers have overtaken the
+ * producers, so the producers don't enqueue into the skipped cells.
+ */
+static void
+crq_fix(struct crq *crq) {
+	for (;;) {
+		uint64_t t = atomic_load(&crq->tail);
+		uint64_t h = atomic_load(&crq->head);
+
+		if (atomic_load(&crq->tail) != t) {
+			continue;
+		}
+		/* A closed tail is always larger than the head */
+		if (h <= t || atomic_compare_exchange_strong(&crq->tail, &t, h)) {
+			return;
+		}
+	}
+}
+
+static void *
+crq_dequeue(struct crq *crq) {
+	for (;;) {
+		uint64_t h = atomic_fetch_add(&crq->head, 1);
+		struct crq_cell *cell = &crq->ring[h & (CRQ_SIZE - 1)];
+
+		for (;;) {
+			uint64_t idx = __atomic_load_n(&cell->idx, __ATOMIC_ACQUIRE);
+			uint64_t val = __atomic_load_n(&cell->val, __ATOMIC_ACQUIRE);
+			uint64_t round = idx & ~CRQ_SAFE;
+
+			if (round > h) {
+				break;
+			}
+
+			if (val != CRQ_EMPTY) {
+				if (round == h) {
+					if (crq_cas2(cell, idx, val, (idx & CRQ_SAFE) | (h + CRQ_SIZE), CRQ_EMPTY)) {
+						return ((void *)(uintptr_t)val);
+					}
+				} else if (crq_cas2(cell, idx, val, round, val)) {
+					/* The value from an older round is left to its consumer */
+					break;
+				}
+			} else if (crq_cas2(cell, idx, CRQ_EMPTY, (idx & CRQ_SAFE) | (h + CRQ_SIZE), CRQ_EMPTY)) {
+				/* The producer of this round won't use the cell */
+				break;
+			}
+		}
+
+		uint64_t t = atomic_load(&crq->tail) & ~CRQ_CLOSED;
+		if (t <= h + 1) {
+			crq_fix(crq);
+			return (NULL);
+		}
+	}
+}
+
+struct lcrq *
+lcrq_new(void) {
+	struct lcrq *lcrq = aligned_alloc(alignof(struct lcrq), sizeof(*lcrq));
+	struct crq *crq = crq_new(NULL);
+
+	atomic_init(&lcrq->head, crq);
+	atomic_init(&lcrq->tail, crq);
+
+	return (lcrq);
+}
+
+void
+lcrq_destroy(struct lcrq *lcrq) {
+	struct crq *crq = atomic_load_relaxed(&lcrq->head);
+
+	while (crq != NULL) {
+		struct crq *next = atomic_load_relaxed(&crq->next);
+		free(crq);
+		crq = next;
+	}
+
+	free(lcrq);
+}
+
+void
+lcrq_enqueue(struct lcrq *lcrq, void *ptr) {
+	for (;;) {
+		struct crq *crq = atomic_load_acquire(&lcrq->tail);
+		struct crq *next = atomic_load_acquire(&crq->next);
+
+		if (next != NULL) {
+			(void)atomic_compare_exchange_strong(&lcrq->tail, &crq, next);
+			continue;
+		}
+
+		if (crq_enqueue(crq, ptr)) {
+			return;
+		}
+
+		/* The CRQ is closed, append a new one with the element */
+		struct crq *newcrq = crq_new(ptr);
+		if (atomic_compare_exchange_strong(&crq->next, &next, newcrq)) {
+			(void)atomic_compare_exchange_strong(&lcrq->tail, &crq, newcrq);
+			return;
+		}
+
+		/* Somebody else has appended first */
+		free(newcrq);
+	}
+}
+
+void *
+lcrq_dequeue(struct lcrq *lcrq) {
+	for (;;) {
+		struct crq *crq = atomic_load_acquire(&lcrq->head);
+		void *ptr = crq_dequeue(crq);
+		if (ptr != NULL) {
+			return (ptr);
+		}
+
+		struct crq *next = atomic_load_acquire(&crq->next);
+		if (next == NULL) {
+			return (NULL);
+		}
+
+		/* An enqueue may have completed before the CRQ got closed */
+		ptr = crq_dequeue(crq);
+		if (ptr != NULL) {
+			return (ptr);
+		}
+
+		/*
+		 * The appender links the next segment before it swings the
+		 * tail, so help it first: the retired segment must not be
+		 * reachable from the tail either.
+		 */
+		struct crq *tail = crq;
+		(void)atomic_compare_exchange_strong(&lcrq->tail, &tail, next);
+
+		if (atomic_compare_exchange_strong(&lcrq->head, &crq, next)) {
+			call_rcu(&crq->rcu_head, crq_free_rcu);
+		}
+	}
+}
+
+#endif /* HAVE_LCRQ */
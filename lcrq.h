@@ -0,0 +1,74 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file lcrq.h
+ * LCRQ: unbounded MPMC queue of pointers (Morrison, Afek: Fast Concurrent
+ * Queues for x86 Processors, PPoPP 2013).
+ *
+ * The queue is a linked list of CRQ segments.  A CRQ is a ring of
+ * CRQ_SIZE cells where both the producers and the consumers take their
+ * cell with a fetch-and-add on the tail or head counter, so they don't
+ * retry on a contended compare-and-swap like the Michael-Scott queue does.
+ * A cell holds the value and the index of the round it belongs to, and is
+ * updated with a double-width compare-and-swap.  A producer that finds the
+ * ring full (or keeps losing its cells to the consumers) closes the CRQ
+ * and appends a new one.
+ *
+ * The drained segments are freed with call_rcu(), so lcrq_enqueue() and
+ * lcrq_dequeue() must be called inside an RCU read-side critical section.
+ *
+ * The double-width compare-and-swap needs cmpxchg16b on x86_64 (-mcx16),
+ * HAVE_LCRQ is not defined when the compiler can't inline it.
+ */
+
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+#define HAVE_LCRQ 1
+#endif /* if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16) */
+
+#if HAVE_LCRQ
+
+#include <stddef.h>
+
+#ifndef CRQ_ORDER
+#define CRQ_ORDER 10
+#endif /* ifndef CRQ_ORDER */
+
+#define CRQ_SIZE (1 << CRQ_ORDER)
+
+/*
+ * Number of failed enqueues into the same CRQ before the producer gives up
+ * and closes it.
+ */
+#ifndef CRQ_STARVATION
+#define CRQ_STARVATION 16
+#endif /* ifndef CRQ_STARVATION */
+
+struct lcrq;
+
+struct lcrq *
+lcrq_new(void);
+
+void
+lcrq_destroy(struct lcrq *lcrq);
+/*%<
+ * Free the queue, the elements still in the queue are not freed.
+ */
+
+void
+lcrq_enqueue(struct lcrq *lcrq, void *ptr);
+/*%<
+ * Enqueue 'ptr', which must not be NULL.
+ */
+
+void *
+lcrq_dequeue(struct lcrq *lcrq);
+/*%<
+ * Dequeue the oldest element, NULL when the queue is empty.
+ */
+
+#endif /* HAVE_LCRQ */
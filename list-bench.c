@@ -9,19 +9,47 @@
 #endif
 
 #include <assert.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <threads.h>
 #include <time.h>
-#include <urcu.h>
-#include <urcu/cds.h>
 #include <uv.h>
 
+#include "alloc.h"
+#include "ebr.h"
+#include "fairness.h"
+#include "hugemem.h"
+#include "mem.h"
+#include "perf.h"
+#include "phase.h"
+#include "rcu.h"
 #include "rwlock.h"
 #include "util.h"
 
+struct thread_s;
+struct data;
+
+/*
+ * Safe memory reclamation scheme used by the backend's readers.
+ */
+enum smr {
+	SMR_NONE = 0,
+	SMR_RCU,
+	SMR_EBR,
+};
+
+struct test {
+	const char *name;
+	void *(*new)(void);
+	void (*write)(struct thread_s *arg, struct data *data);
+	void (*read)(struct thread_s *arg);
+	void (*destroy)(void *);
+	enum smr smr;
+};
+
 struct thread_s {
 	uv_thread_t thread;
 	uv_mutex_t *mutex;
@@ -29,12 +57,16 @@ struct thread_s {
 	uv_barrier_t *barrier;
 	uv_thread_cb cb;
 	rwlock_t *crwwp;
+	const struct test *test;
 	uint64_t ops;
 	uint64_t reads;
 	uint64_t writes;
 	uint64_t diff;
 	uint8_t rws;
 	void *data;
+	struct perf_counters perf;
+	struct phases phases;
+	struct fairness fairness;
 };
 
 struct data {
@@ -44,147 +76,231 @@ struct data {
 
 static bool *rnd;
 
+/*
+ * The backends below mark the end of every phase of the operation with
+ * phase_mark(), the allocation phase is marked by the list_run() loop.
+ */
+
 static void
-mutex_list_run(void *arg0) {
-	struct thread_s *arg = arg0;
-	struct timespec start, end;
+mutex_write(struct thread_s *arg, struct data *newdata) {
 	struct cds_list_head *head = arg->data;
 
-	(void)uv_barrier_wait(arg->barrier);
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_add(&newdata->head, head);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+}
 
-	time_now(&start);
+static void
+mutex_read(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct cds_list_head *pos, *p;
 
-	for (size_t i = 0; i < arg->ops; i++) {
-		if (rnd[i]) {
-			arg->writes++;
-			struct data *newdata = malloc(sizeof(*newdata));
-			uv_mutex_lock(arg->mutex);
-			cds_list_add(&newdata->head, head);
-			uv_mutex_unlock(arg->mutex);
-		} else {
-			arg->reads++;
-			uv_mutex_lock(arg->mutex);
-			struct cds_list_head *pos, *p;
-			cds_list_for_each_safe(pos, p, head);
-			uv_mutex_unlock(arg->mutex);
-		}
-	}
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_for_each_safe(pos, p, head);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+}
 
-	time_now(&end);
+static void
+rwlock_write(struct thread_s *arg, struct data *newdata) {
+	struct cds_list_head *head = arg->data;
 
-	arg->diff = time_microdiff(&end, &start);
+	pthread_rwlock_wrlock(arg->rwlock);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_add(&newdata->head, head);
+	phase_mark(PHASE_CRITICAL);
+	pthread_rwlock_unlock(arg->rwlock);
+	phase_mark(PHASE_RELEASE);
 }
 
 static void
-rwlock_list_run(void *arg0) {
-	struct thread_s *arg = arg0;
-	struct timespec start, end;
+rwlock_read(struct thread_s *arg) {
 	struct cds_list_head *head = arg->data;
+	struct cds_list_head *pos, *p;
 
-	(void)uv_barrier_wait(arg->barrier);
+	pthread_rwlock_rdlock(arg->rwlock);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_for_each_safe(pos, p, head);
+	phase_mark(PHASE_CRITICAL);
+	pthread_rwlock_unlock(arg->rwlock);
+	phase_mark(PHASE_RELEASE);
+}
 
-	time_now(&start);
+static void
+crwwp_write(struct thread_s *arg, struct data *newdata) {
+	struct cds_list_head *head = arg->data;
 
-	for (size_t i = 0; i < arg->ops; i++) {
-		if (rnd[i]) {
-			arg->writes++;
-			struct data *newdata = malloc(sizeof(*newdata));
-			pthread_rwlock_wrlock(arg->rwlock);
-			cds_list_add(&newdata->head, head);
-			pthread_rwlock_unlock(arg->rwlock);
-		} else {
-			arg->reads++;
-			pthread_rwlock_rdlock(arg->rwlock);
-			struct cds_list_head *pos, *p;
-			cds_list_for_each_safe(pos, p, head);
-			pthread_rwlock_unlock(arg->rwlock);
-		}
-	}
+	rwlock_wrlock(arg->crwwp);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_add(&newdata->head, head);
+	phase_mark(PHASE_CRITICAL);
+	rwlock_wrunlock(arg->crwwp);
+	phase_mark(PHASE_RELEASE);
+}
 
-	time_now(&end);
+static void
+crwwp_read(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct cds_list_head *pos, *p;
 
-	arg->diff = time_microdiff(&end, &start);
+	rwlock_rdlock(arg->crwwp);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_for_each_safe(pos, p, head);
+	phase_mark(PHASE_CRITICAL);
+	rwlock_rdunlock(arg->crwwp);
+	phase_mark(PHASE_RELEASE);
 }
 
 static void
-crwwp_list_run(void *arg0) {
-	struct thread_s *arg = arg0;
-	struct timespec start, end;
+rcu_write(struct thread_s *arg, struct data *newdata) {
 	struct cds_list_head *head = arg->data;
 
-	(void)uv_barrier_wait(arg->barrier);
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_add_rcu(&newdata->head, head);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+}
 
-	time_now(&start);
+static void
+rcu_read(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct cds_list_head *pos, *p;
 
-	for (size_t i = 0; i < arg->ops; i++) {
-		if (rnd[i]) {
-			arg->writes++;
-			struct data *newdata = malloc(sizeof(*newdata));
-			rwlock_wrlock(arg->crwwp);
-			cds_list_add(&newdata->head, head);
-			rwlock_wrunlock(arg->crwwp);
-		} else {
-			arg->reads++;
-			rwlock_rdlock(arg->crwwp);
-			struct cds_list_head *pos, *p;
-			cds_list_for_each_safe(pos, p, head);
-			rwlock_rdunlock(arg->crwwp);
-		}
-	}
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_for_each_safe(pos, p, head);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+}
 
-	time_now(&end);
+static void
+ebr_read(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct cds_list_head *pos, *p;
 
-	arg->diff = time_microdiff(&end, &start);
+	ebr_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_for_each_safe(pos, p, head);
+	phase_mark(PHASE_CRITICAL);
+	ebr_read_unlock();
+	phase_mark(PHASE_RELEASE);
 }
 
 static void
-rcu_list_run(void *arg0) {
+list_run(void *arg0) {
 	struct thread_s *arg = arg0;
+	const struct test *test = arg->test;
 	struct timespec start, end;
-	struct cds_list_head *head = arg->data;
 
-	rcu_register_thread();
+	switch (test->smr) {
+	case SMR_RCU:
+		rcu_register_thread();
+		rcu_offline();
+		break;
+	case SMR_EBR:
+		ebr_register_thread();
+		break;
+	case SMR_NONE:
+		break;
+	}
+	perf_open(&arg->perf);
 	(void)uv_barrier_wait(arg->barrier);
+	if (test->smr == SMR_RCU) {
+		rcu_online();
+	}
 
+	perf_start(&arg->perf);
 	time_now(&start);
 
 	for (size_t i = 0; i < arg->ops; i++) {
+		uint64_t begin = fairness_begin();
+		phase_begin(&arg->phases, i);
 		if (rnd[i]) {
 			arg->writes++;
-			struct data *newdata = malloc(sizeof(*newdata));
-			uv_mutex_lock(arg->mutex);
-			cds_list_add_rcu(&newdata->head, head);
-			uv_mutex_unlock(arg->mutex);
+			struct data *newdata = node_alloc(sizeof(*newdata));
+			phase_mark(PHASE_ALLOCATE);
+
+			test->write(arg, newdata);
 		} else {
 			arg->reads++;
-			rcu_read_lock();
-			struct cds_list_head *pos, *p;
-			cds_list_for_each_safe(pos, p, head);
-			rcu_read_unlock();
+			test->read(arg);
+		}
+		phase_end();
+		fairness_end(&arg->fairness, begin, rnd[i]);
+
+		if (test->smr == SMR_RCU) {
+			rcu_quiescent(i);
 		}
 	}
 
 	time_now(&end);
+	perf_stop(&arg->perf);
 
 	arg->diff = time_microdiff(&end, &start);
-
-	rcu_unregister_thread();
+	perf_close(&arg->perf);
+
+	switch (test->smr) {
+	case SMR_RCU:
+		rcu_unregister_thread();
+		break;
+	case SMR_EBR:
+		ebr_unregister_thread();
+		break;
+	case SMR_NONE:
+		break;
+	}
 }
 
 struct thread_s *threads;
 
+enum {
+	OPT_HITM_EVENT = 256,
+	OPT_HUGE_PAGES,
+	OPT_PREFAULT,
+	OPT_MLOCK,
+};
+
+static struct option long_options[] = {
+	{ "allocator", required_argument, NULL, 'a' },
+	{ "perf", no_argument, NULL, 'p' },
+	{ "hitm-event", required_argument, NULL, OPT_HITM_EVENT },
+	{ "sample", required_argument, NULL, 's' },
+	{ "fairness", optional_argument, NULL, 'f' },
+	{ "memory", optional_argument, NULL, 'm' },
+	{ "qsbr-period", required_argument, NULL, 'q' },
+	{ "huge-pages", optional_argument, NULL, OPT_HUGE_PAGES },
+	{ "prefault", optional_argument, NULL, OPT_PREFAULT },
+	{ "mlock", no_argument, NULL, OPT_MLOCK },
+	{ NULL, 0, NULL, 0 },
+};
+
 void
 usage(int argc [[maybe_unused]], char **argv) {
-	fprintf(stderr, "usage: %s <num_threads> <num_ops> <read_write_ratio> [<r|w|n>]\n", argv[0]);
+	fprintf(stderr,
+		"usage: %s [options] <num_threads> <num_ops> <read_write_ratio> [<r|w|n>]\n"
+		"\n"
+		"  -a, --allocator=<name>  allocate the nodes with jemalloc (default), je-arena,\n"
+		"                           je-notcache, malloc, pool, mctx or all of them in turn\n"
+		"  -p, --perf               report per-op hardware/software performance counters\n"
+		"      --hitm-event=<code>  raw PMU event counting HITM loads (e.g. 0x04d2 on Skylake)\n"
+		"  -s, --sample=<n>         break every n-th op down into phases (ns per sampled op)\n"
+		"  -f, --fairness[=<us>]    report per-thread fairness, flag ops blocked longer than <us>\n"
+		"  -m, --memory[=<ms>]      sample RSS and jemalloc stats every <ms> during the run\n"
+		"  -q, --qsbr-period=<k>    announce a QSBR quiescent state every <k> ops (urcu flavor: " RCU_FLAVOR ")\n"
+		"      --huge-pages[=<m>]   back the op arrays and pool slabs with <m>=thp (default) or hugetlb\n"
+		"      --prefault[=<MiB>]   pre-fault the op arrays and <MiB> of pool slabs before the run\n"
+		"      --mlock              lock the op arrays and pool slabs in memory\n",
+		argv[0]);
 }
 
-struct test {
-	const char *name;
-	void *(*new)(void);
-	uv_thread_cb run;
-	void (*destroy)(void *);
-};
-
 static void *
 list_new(void) {
 	struct cds_list_head *head = malloc(sizeof(*head));
@@ -200,39 +316,111 @@ list_destroy(void *arg) {
 
 	cds_list_for_each_safe(pos, p, head) {
 		struct data *data = caa_container_of(pos, struct data, head);
-		free(data);
+		node_free(data, sizeof(*data));
 	}
 }
 
 static struct test test_list[] = {
-	{ "mutex", list_new, mutex_list_run, list_destroy },
-	{ "rwlock", list_new, rwlock_list_run, list_destroy },
-	{ "c-rw-wp", list_new, crwwp_list_run, list_destroy },
-	{ "rcu", list_new, rcu_list_run, list_destroy },
-	{ NULL, NULL, NULL, NULL },
+	{ "mutex", list_new, mutex_write, mutex_read, list_destroy, SMR_NONE },
+	{ "rwlock", list_new, rwlock_write, rwlock_read, list_destroy, SMR_NONE },
+	{ "c-rw-wp", list_new, crwwp_write, crwwp_read, list_destroy, SMR_NONE },
+	{ "rcu", list_new, rcu_write, rcu_read, list_destroy, SMR_RCU },
+	{ "ebr", list_new, rcu_write, ebr_read, list_destroy, SMR_EBR },
+	{ NULL, NULL, NULL, NULL, NULL, SMR_NONE },
 };
 
 int
 main(int argc, char **argv) {
-	if (argc < 4) {
+	bool perf = false;
+	uint64_t memory = 0;
+	uint64_t hitm_event = 0;
+	bool matrix = false;
+	bool huge_pages = false;
+	bool prefault = false;
+	bool lock = false;
+	uint64_t prefault_mib = 0;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "a:ps:f::m::q:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			if (strcmp(optarg, "all") == 0) {
+				matrix = true;
+			} else if (!allocator_set(optarg)) {
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case 'p':
+			perf = true;
+			break;
+		case OPT_HITM_EVENT:
+			hitm_event = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			phase_rate = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			fairness_enabled = true;
+			if (optarg != NULL) {
+				fairness_threshold = strtoull(optarg, NULL, 0) * NS_PER_US;
+			}
+			break;
+		case 'm':
+			memory = (optarg != NULL) ? strtoull(optarg, NULL, 0) : 10;
+			break;
+		case 'q':
+			rcu_qsbr_period = strtoull(optarg, NULL, 0);
+			if (rcu_qsbr_period == 0) {
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case OPT_HUGE_PAGES:
+			if (!hugemem_set((optarg != NULL) ? optarg : "thp")) {
+				usage(argc, argv);
+				exit(1);
+			}
+			huge_pages = true;
+			break;
+		case OPT_PREFAULT:
+			prefault = true;
+			prefault_mib = (optarg != NULL) ? strtoull(optarg, NULL, 0) : 0;
+			break;
+		case OPT_MLOCK:
+			lock = true;
+			break;
+		default:
+			usage(argc, argv);
+			exit(1);
+		}
+	}
+
+	char **args = argv + optind;
+	int nargs = argc - optind;
+
+	if (nargs < 3) {
 		usage(argc, argv);
 		exit(1);
 	}
 
-	uint8_t num_threads = atoi(argv[1]);
-	uint64_t num_ops = atoll(argv[2]);
-	uint8_t rws = atoi(argv[3]);
+	uint8_t num_threads = atoi(args[0]);
+	uint64_t num_ops = atoll(args[1]);
+	uint8_t rws = atoi(args[2]);
 	uint64_t writes = 0;
 	uint64_t reads = 0;
 	pthread_rwlockattr_t attr;
 
-	if (argc > 4) {
+	perf_init(perf, hitm_event);
+	hugemem_options(prefault, lock);
+
+	if (nargs > 3) {
 		int r;
-		if (argv[4][0] == 'r') {
+		if (args[3][0] == 'r') {
 			r = pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_READER_NP);
-		} else if (argv[4][0] == 'w') {
+		} else if (args[3][0] == 'w') {
 			r = pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NP);
-		} else if (argv[4][0] == 'n') {
+		} else if (args[3][0] == 'n') {
 			r = pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
 		} else {
 			usage(argc, argv);
@@ -249,7 +437,7 @@ main(int argc, char **argv) {
 
 	threads = calloc(num_threads, sizeof(threads[0]));
 
-	rnd = calloc(num_ops, sizeof(*rnd));
+	rnd = hugemem_alloc(num_ops * sizeof(*rnd));
 	random_buf(rnd, num_ops * sizeof(*rnd));
 
 	uint32_t tmp = (rws * 255) / 100;
@@ -263,69 +451,154 @@ main(int argc, char **argv) {
 		}
 	}
 
-	printf("%10s | %10s | %10s | %10s | %10s \n", "", "threads", "reads", "writes", "seconds");
-
-	for (struct test *test = test_list; test->name != NULL; test++) {
-		uv_mutex_t mutex;
-		pthread_rwlock_t rwlock;
-		uv_barrier_t barrier;
-		rwlock_t crwwp;
-
-		int r = uv_barrier_init(&barrier, num_threads);
-		assert(r == 0);
+	if (prefault && (matrix || allocator_get() == ALLOCATOR_POOL || allocator_get() == ALLOCATOR_MCTX)) {
+		/* Every op of every thread can be a write */
+		size_t size = (prefault_mib != 0) ? prefault_mib * 1024 * 1024
+						  : num_ops * num_threads * sizeof(struct data);
+		hugemem_reserve(size);
+	}
 
-		r = uv_mutex_init(&mutex);
-		assert(r == 0);
+	printf("%10s ", "");
+	if (matrix) {
+		printf("| %11s ", "allocator");
+	}
+	printf("| %10s | %10s | %10s | %10s ", "threads", "reads", "writes", "seconds");
+	if (perf_enabled()) {
+		perf_print_header();
+	}
+	if (phase_rate != 0) {
+		phase_print_header();
+	}
+	if (fairness_enabled) {
+		fairness_print_header();
+	}
+	if (memory != 0) {
+		mem_print_header();
+	}
+	if (huge_pages || prefault || lock) {
+		hugemem_print_header();
+	}
+	printf("\n");
 
-		r = pthread_rwlock_init(&rwlock, &attr);
-		assert(r == 0);
+	enum allocator alloc_first = matrix ? 0 : allocator_get();
+	enum allocator alloc_last = matrix ? ALLOCATOR_MAX - 1 : allocator_get();
 
-		rwlock_setworkers(num_threads);
-		rwlock_init(&crwwp);
+	for (struct test *test = test_list; test->name != NULL; test++) {
+		for (enum allocator a = alloc_first; a <= alloc_last; a++) {
+			allocator_select(a);
 
-		void *data = test->new();
+			uv_mutex_t mutex;
+			pthread_rwlock_t rwlock;
+			uv_barrier_t barrier;
+			rwlock_t crwwp;
 
-		for (size_t i = 0; i < num_threads; i++) {
-			struct thread_s *t = &threads[i];
-			*t = (struct thread_s){
-				.barrier = &barrier,
-				.mutex = &mutex,
-				.rwlock = &rwlock,
-				.crwwp = &crwwp,
-				.ops = num_ops,
-				.rws = rws,
-				.data = data,
-			};
+			int r = uv_barrier_init(&barrier, num_threads);
+			assert(r == 0);
 
-			r = uv_thread_create(&t->thread, test->run, t);
+			r = uv_mutex_init(&mutex);
 			assert(r == 0);
-		}
 
-		uint64_t diff = 0;
-		writes = 0;
-		reads = 0;
-		for (size_t i = 0; i < num_threads; i++) {
-			struct thread_s *t = &threads[i];
-			r = uv_thread_join(&t->thread);
+			r = pthread_rwlock_init(&rwlock, &attr);
 			assert(r == 0);
 
-			diff += t->diff;
-			writes += t->writes;
-			reads += t->reads;
+			rwlock_setworkers(num_threads);
+			rwlock_init(&crwwp);
+
+			void *data = test->new();
+
+			if (memory != 0) {
+				mem_sampler_start(memory);
+			}
+
+			for (size_t i = 0; i < num_threads; i++) {
+				struct thread_s *t = &threads[i];
+				*t = (struct thread_s){
+					.barrier = &barrier,
+					.mutex = &mutex,
+					.rwlock = &rwlock,
+					.crwwp = &crwwp,
+					.ops = num_ops,
+					.rws = rws,
+					.data = data,
+					.test = test,
+				};
+
+				r = uv_thread_create(&t->thread, list_run, t);
+				assert(r == 0);
+			}
+
+			uint64_t diff = 0;
+			struct perf_counters perf_sum;
+			struct phases phase_sum = { 0 };
+			double ops_per_sec[num_threads];
+			struct fairness fairness[num_threads];
+			perf_reset(&perf_sum);
+			writes = 0;
+			reads = 0;
+			for (size_t i = 0; i < num_threads; i++) {
+				struct thread_s *t = &threads[i];
+				r = uv_thread_join(&t->thread);
+				assert(r == 0);
+
+				diff += t->diff;
+				writes += t->writes;
+				reads += t->reads;
+				perf_add(&perf_sum, &t->perf);
+				phase_add(&phase_sum, &t->phases);
+				ops_per_sec[i] = (t->diff > 0) ? (double)(t->reads + t->writes) * US_PER_SEC / t->diff : 0.0;
+				fairness[i] = t->fairness;
+			}
+
+			struct mem_sample mem_peak, mem_end, mem_post;
+			if (memory != 0) {
+				mem_sampler_stop(&mem_peak);
+				mem_sample(&mem_end);
+			}
+
+			test->destroy(data);
+
+			if (memory != 0) {
+				/* Let the deferred frees run before the teardown sample */
+				rcu_barrier();
+				mem_sample(&mem_post);
+			}
+
+			printf("%10s ", test->name);
+			if (matrix) {
+				printf("| %11s ", allocator_name());
+			}
+			printf("| %10zu | %10" PRIu64 " | %10" PRIu64 " | %10.4f ", (size_t)num_threads, reads, writes,
+			       (double)(diff / num_threads) / (US_PER_SEC));
+			if (perf_enabled()) {
+				perf_print(&perf_sum, reads + writes);
+			}
+			if (phase_rate != 0) {
+				phase_print(&phase_sum);
+			}
+			if (fairness_enabled) {
+				fairness_print(test->name, ops_per_sec, fairness, num_threads);
+			}
+			if (memory != 0) {
+				mem_print(&mem_peak, &mem_end, &mem_post);
+			}
+			if (huge_pages || prefault || lock) {
+				hugemem_print();
+			}
+			printf("\n");
+
+			rwlock_destroy(&crwwp);
+			uv_mutex_destroy(&mutex);
+			pthread_rwlock_destroy(&rwlock);
+			uv_barrier_destroy(&barrier);
+
+			if (matrix) {
+				/* The deferred frees must reach the allocator of this run */
+				rcu_barrier();
+			}
 		}
-
-		printf("%10s | %10zu | %10" PRIu64 " | %10" PRIu64 " | %10.4f \n", test->name, (size_t)num_threads,
-		       reads, writes, (double)(diff / num_threads) / (US_PER_SEC));
-
-		test->destroy(data);
-
-		rwlock_destroy(&crwwp);
-		uv_mutex_destroy(&mutex);
-		pthread_rwlock_destroy(&rwlock);
-		uv_barrier_destroy(&barrier);
 	}
 
-	free(rnd);
+	hugemem_free(rnd, num_ops * sizeof(*rnd));
 	free(threads);
 
 	return 0;
@@ -0,0 +1,338 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#ifndef _LGPL_SOURCE
+#define _LGPL_SOURCE 1
+#endif
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+#include "lscq.h"
+#include "rcu.h"
+
+/*
+ * The ring has twice as many entries as there are indices.  An entry is
+ * the cycle, the safe bit and the index, with two reserved index values
+ * for an empty entry (SCQ_BOTTOM) and a consumed one (SCQ_BOTTOM_C, the
+ * consumer ORs it into the entry).
+ */
+#define SCQ_ENTRIES	(2 * SCQ_SIZE)
+#define SCQ_INDEX_MASK	((uint64_t)SCQ_ENTRIES - 1)
+#define SCQ_BOTTOM	((uint64_t)SCQ_ENTRIES - 1)
+#define SCQ_BOTTOM_C	((uint64_t)SCQ_ENTRIES - 2)
+#define SCQ_SAFE	((uint64_t)SCQ_ENTRIES)
+#define SCQ_CYCLE_SHIFT (SCQ_ORDER + 2)
+#define SCQ_THRESHOLD	(3 * SCQ_SIZE - 1)
+#define SCQ_FINALIZE	(UINT64_C(1) << 63) /* In the tail */
+#define SCQ_NONE	UINT64_MAX
+
+struct scq {
+	alignas(64) atomic_uint_fast64_t head;
+	alignas(64) atomic_uint_fast64_t tail;
+	alignas(64) atomic_int_fast64_t threshold;
+	alignas(64) atomic_uint_fast64_t entries[SCQ_ENTRIES];
+};
+
+struct lscq_segment {
+	struct scq aq; /* The indices of the allocated data */
+	struct scq fq; /* The free indices */
+	alignas(64) _Atomic(struct lscq_segment *) next;
+	struct rcu_head rcu_head;
+	void *data[SCQ_SIZE];
+};
+
+struct lscq {
+	alignas(64) _Atomic(struct lscq_segment *) head;
+	alignas(64) _Atomic(struct lscq_segment *) tail;
+};
+
+/*
+ * Spread the consecutive positions over different cache lines.
+ */
+static size_t
+scq_remap(uint64_t pos) {
+	const unsigned int line_bits = 3; /* 8 entries per cache line */
+	const unsigned int bits = SCQ_ORDER + 1;
+
+	pos &= SCQ_INDEX_MASK;
+
+	return (((pos << line_bits) | (pos >> (bits - line_bits))) & SCQ_INDEX_MASK);
+}
+
+static uint64_t
+scq_cycle(uint64_t pos) {
+	return ((pos & ~SCQ_FINALIZE) >> (SCQ_ORDER + 1));
+}
+
+static void
+scq_init(struct scq *scq, bool full) {
+	for (size_t i = 0; i < SCQ_ENTRIES; i++) {
+		atomic_init(&scq->entries[i], SCQ_SAFE | SCQ_BOTTOM);
+	}
+
+	atomic_init(&scq->head, SCQ_ENTRIES);
+	atomic_init(&scq->tail, SCQ_ENTRIES);
+	atomic_init(&scq->threshold, -1);
+
+	if (full) {
+		for (uint64_t i = 0; i < SCQ_SIZE; i++) {
+			uint64_t pos = SCQ_ENTRIES + i;
+			atomic_init(&scq->entries[scq_remap(pos)],
+				    (scq_cycle(pos) << SCQ_CYCLE_SHIFT) | SCQ_SAFE | i);
+		}
+		atomic_init(&scq->tail, SCQ_ENTRIES + SCQ_SIZE);
+		atomic_init(&scq->threshold, SCQ_THRESHOLD);
+	}
+}
+
+/*
+ * False only when the ring has been finalized.
+ */
+static bool
+scq_enqueue(struct scq *scq, uint64_t index) {
+	for (;;) {
+		uint64_t t = atomic_fetch_add(&scq->tail, 1);
+		if ((t & SCQ_FINALIZE) != 0) {
+			return (false);
+		}
+
+		atomic_uint_fast64_t *entry = &scq->entries[scq_remap(t)];
+		uint64_t cycle = scq_cycle(t);
+		uint64_t e = atomic_load_acquire(entry);
+
+		for (;;) {
+			uint64_t eindex = e & SCQ_INDEX_MASK;
+
+			if ((e >> SCQ_CYCLE_SHIFT) >= cycle || (eindex != SCQ_BOTTOM && eindex != SCQ_BOTTOM_C)) {
+				break;
+			}
+			/* An unsafe entry can be used only when no consumer waits for it */
+			if ((e & SCQ_SAFE) == 0 && atomic_load(&scq->head) > t) {
+				break;
+			}
+
+			if (atomic_compare_exchange_weak(entry, &e, (cycle << SCQ_CYCLE_SHIFT) | SCQ_SAFE | index)) {
+				if (atomic_load(&scq->threshold) != SCQ_THRESHOLD) {
+					atomic_store(&scq->threshold, SCQ_THRESHOLD);
+				}
+				return (true);
+			}
+		}
+	}
+}
+
+static void
+scq_catchup(struct scq *scq, uint64_t tail, uint64_t head) {
+	while (!atomic_compare_exchange_weak(&scq->tail, &tail, head)) {
+		head = atomic_load(&scq->head);
+		tail = atomic_load(&scq->tail);
+		/* A finalized tail is always larger than the head */
+		if (tail >= head) {
+			break;
+		}
+	}
+}
+
+static uint64_t
+scq_dequeue(struct scq *scq) {
+	if (atomic_load(&scq->threshold) < 0) {
+		return (SCQ_NONE);
+	}
+
+	for (;;) {
+		uint64_t h = atomic_fetch_add(&scq->head, 1);
+		atomic_uint_fast64_t *entry = &scq->entries[scq_remap(h)];
+		uint64_t cycle = scq_cycle(h);
+		uint64_t e = atomic_load_acquire(entry);
+
+		for (;;) {
+			uint64_t ecycle = e >> SCQ_CYCLE_SHIFT;
+			uint64_t eindex = e & SCQ_INDEX_MASK;
+
+			if (ecycle == cycle) {
+				(void)atomic_fetch_or(entry, SCQ_BOTTOM_C);
+				return (eindex);
+			}
+			if (ecycle > cycle) {
+				break;
+			}
+
+			/*
+			 * The entry is from an older cycle: an empty one is moved
+			 * to this cycle, so the late producer won't use it, and a
+			 * full one is marked unsafe for its own consumer.
+			 */
+			uint64_t new = e & ~SCQ_SAFE;
+			if (eindex == SCQ_BOTTOM || eindex == SCQ_BOTTOM_C) {
+				new = (cycle << SCQ_CYCLE_SHIFT) | (e & SCQ_SAFE) | SCQ_BOTTOM;
+			}
+			if (atomic_compare_exchange_weak(entry, &e, new)) {
+				break;
+			}
+		}
+
+		uint64_t t = atomic_load(&scq->tail);
+		if ((t & ~SCQ_FINALIZE) <= h + 1) {
+			if ((t & SCQ_FINALIZE) == 0) {
+				scq_catchup(scq, t, h + 1);
+			}
+			(void)atomic_fetch_sub(&scq->threshold, 1);
+			return (SCQ_NONE);
+		}
+		if (atomic_fetch_sub(&scq->threshold, 1) <= 0) {
+			return (SCQ_NONE);
+		}
+	}
+}
+
+static bool
+lscq_segment_enqueue(struct lscq_segment *segment, void *ptr) {
+	uint64_t index = scq_dequeue(&segment->fq);
+	if (index == SCQ_NONE) {
+		/* Out of free indices, no more enqueues into this segment */
+		(void)atomic_fetch_or(&segment->aq.tail, SCQ_FINALIZE);
+		return (false);
+	}
+
+	segment->data[index] = ptr;
+	if (!scq_enqueue(&segment->aq, index)) {
+		(void)scq_enqueue(&segment->fq, index);
+		return (false);
+	}
+
+	return (true);
+}
+
+static void *
+lscq_segment_dequeue(struct lscq_segment *segment) {
+	uint64_t index = scq_dequeue(&segment->aq);
+	if (index == SCQ_NONE) {
+		return (NULL);
+	}
+
+	void *ptr = segment->data[index];
+	(void)scq_enqueue(&segment->fq, index);
+
+	return (ptr);
+}
+
+static struct lscq_segment *
+lscq_segment_new(void *first) {
+	struct lscq_segment *segment = aligned_alloc(alignof(struct lscq_segment), sizeof(*segment));
+
+	scq_init(&segment->aq, false);
+	scq_init(&segment->fq, true);
+	atomic_init(&segment->next, NULL);
+
+	if (first != NULL) {
+		bool ok = lscq_segment_enqueue(segment, first);
+		(void)ok;
+	}
+
+	return (segment);
+}
+
+static void
+lscq_segment_free_rcu(struct rcu_head *rcu_head) {
+	free(caa_container_of(rcu_head, struct lscq_segment, rcu_head));
+}
+
+struct lscq *
+lscq_new(void) {
+	struct lscq *lscq = aligned_alloc(alignof(struct lscq), sizeof(*lscq));
+	struct lscq_segment *segment = lscq_segment_new(NULL);
+
+	atomic_init(&lscq->head, segment);
+	atomic_init(&lscq->tail, segment);
+
+	return (lscq);
+}
+
+void
+lscq_destroy(struct lscq *lscq) {
+	struct lscq_segment *segment = atomic_load_relaxed(&lscq->head);
+
+	while (segment != NULL) {
+		struct lscq_segment *next = atomic_load_relaxed(&segment->next);
+		free(segment);
+		segment = next;
+	}
+
+	free(lscq);
+}
+
+void
+lscq_enqueue(struct lscq *lscq, void *ptr) {
+	for (;;) {
+		struct lscq_segment *segment = atomic_load_acquire(&lscq->tail);
+		struct lscq_segment *next = atomic_load_acquire(&segment->next);
+
+		if (next != NULL) {
+			(void)atomic_compare_exchange_strong(&lscq->tail, &segment, next);
+			continue;
+		}
+
+		if (lscq_segment_enqueue(segment, ptr)) {
+			return;
+		}
+
+		struct lscq_segment *newsegment = lscq_segment_new(ptr);
+		if (atomic_compare_exchange_strong(&segment->next, &next, newsegment)) {
+			(void)atomic_compare_exchange_strong(&lscq->tail, &segment, newsegment);
+			return;
+		}
+
+		/* Somebody else has appended first */
+		free(newsegment);
+	}
+}
+
+void *
+lscq_dequeue(struct lscq *lscq) {
+	for (;;) {
+		struct lscq_segment *segment = atomic_load_acquire(&lscq->head);
+		void *ptr = lscq_segment_dequeue(segment);
+		if (ptr != NULL) {
+			return (ptr);
+		}
+
+		struct lscq_segment *next = atomic_load_acquire(&segment->next);
+		if (next == NULL) {
+			return (NULL);
+		}
+
+		/*
+		 * The segment is finalized, reset the threshold so the last
+		 * dequeue sees every element that made it in.
+		 */
+		atomic_store(&segment->aq.threshold, SCQ_THRESHOLD);
+		ptr = lscq_segment_dequeue(segment);
+		if (ptr != NULL) {
+			return (ptr);
+		}
+
+		/*
+		 * The appender links the next segment before it swings the
+		 * tail, so help it first: the retired segment must not be
+		 * reachable from the tail either.
+		 */
+		struct lscq_segment *tail = segment;
+		(void)atomic_compare_exchange_strong(&lscq->tail, &tail, next);
+
+		if (atomic_compare_exchange_strong(&lscq->head, &segment, next)) {
+			call_rcu(&segment->rcu_head, lscq_segment_free_rcu);
+		}
+	}
+}
@@ -0,0 +1,52 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file lscq.h
+ * LSCQ: unbounded MPMC queue of pointers (Nikolaev: A Scalable, Portable,
+ * and Memory-Efficient Lock-Free FIFO Queue, DISC 2019).
+ *
+ * Like LCRQ, the queue is a linked list of ring segments with fetch-and-add
+ * on the head and tail counters, but the rings (SCQ) need just the
+ * single-width compare-and-swap.  A ring entry packs the round ("cycle")
+ * with an index into the data array of the segment, the pointers
+ * themselves are kept in the data array.  Every segment has two rings:
+ * the allocated indices and the free indices.  The consumers give up on
+ * an empty ring after a bounded number of attempts (the threshold), which
+ * keeps the ring lock-free without the double-width compare-and-swap.
+ *
+ * The enqueue appends a new segment when the current one runs out of free
+ * indices.  The drained segments are freed with call_rcu(), so
+ * lscq_enqueue() and lscq_dequeue() must be called inside an RCU read-side
+ * critical section.
+ */
+
+#ifndef SCQ_ORDER
+#define SCQ_ORDER 12
+#endif /* ifndef SCQ_ORDER */
+
+#define SCQ_SIZE (1 << SCQ_ORDER)
+
+struct lscq;
+
+struct lscq *
+lscq_new(void);
+
+void
+lscq_destroy(struct lscq *lscq);
+/*%<
+ * Free the queue, the elements still in the queue are not freed.
+ */
+
+void
+lscq_enqueue(struct lscq *lscq, void *ptr);
+
+void *
+lscq_dequeue(struct lscq *lscq);
+/*%<
+ * Dequeue the oldest element, NULL when the queue is empty.
+ */
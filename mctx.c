@@ -0,0 +1,126 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <uv.h>
+
+#include "atomic.h"
+#include "mctx.h"
+#include "slab.h"
+
+struct mctx {
+	struct slab_cache slab; /* Must be the first member */
+
+	/* The return queue, pushed by the other threads */
+	alignas(SLAB_CACHELINE_SIZE) _Atomic(struct slab_object *) remote[SLAB_CLASSES];
+};
+
+static uv_once_t mctx_once = UV_ONCE_INIT;
+static struct slab_caches mctx_contexts;
+static thread_local struct mctx *mctx_self = NULL;
+
+static void
+mctx_thread_exit(void *arg) {
+	struct mctx *mctx = arg;
+
+	slab_cache_orphan(&mctx_contexts, &mctx->slab);
+}
+
+static void
+mctx_initialize(void) {
+	slab_caches_init(&mctx_contexts, mctx_thread_exit);
+}
+
+static void
+mctx_init(struct slab_cache *slab) {
+	struct mctx *mctx = (struct mctx *)slab;
+
+	for (size_t i = 0; i < SLAB_CLASSES; i++) {
+		atomic_init(&mctx->remote[i], NULL);
+	}
+}
+
+static struct mctx *
+mctx_get(void) {
+	struct mctx *mctx = mctx_self;
+
+	if (mctx != NULL) {
+		return (mctx);
+	}
+
+	uv_once(&mctx_once, mctx_initialize);
+
+	mctx = (struct mctx *)slab_cache_adopt(&mctx_contexts, sizeof(*mctx), alignof(struct mctx), mctx_init);
+	mctx_self = mctx;
+
+	return (mctx);
+}
+
+void *
+mctx_alloc(size_t size) {
+	size_t class = slab_class(size);
+
+	if (class >= SLAB_CLASSES) {
+		return (malloc(size));
+	}
+
+	struct mctx *mctx = mctx_get();
+	struct slab_object *object = mctx->slab.free[class];
+
+	if (object == NULL) {
+		/* Drain the return queue in one go */
+		object = atomic_exchange_acquire(&mctx->remote[class], NULL);
+		if (object == NULL) {
+			slab_new(&mctx->slab, class, MCTX_SLAB_SIZE);
+			object = mctx->slab.free[class];
+		}
+	}
+
+	mctx->slab.free[class] = object->next;
+
+	return (object);
+}
+
+void
+mctx_free(void *ptr, size_t size) {
+	size_t class = slab_class(size);
+
+	if (class >= SLAB_CLASSES) {
+		free(ptr);
+		return;
+	}
+
+	struct slab *slab = slab_of(ptr, MCTX_SLAB_SIZE);
+	struct mctx *owner = (struct mctx *)slab->owner;
+	struct slab_object *object = ptr;
+
+	assert(slab->class == class);
+
+	if (owner == mctx_self) {
+		object->next = owner->slab.free[class];
+		owner->slab.free[class] = object;
+		return;
+	}
+
+	/*
+	 * There's a single consumer that always takes the whole queue, so
+	 * the push doesn't suffer from ABA.
+	 */
+	struct slab_object *head = atomic_load_relaxed(&owner->remote[class]);
+	do {
+		object->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&owner->remote[class], &head, object, memory_order_release,
+							 memory_order_relaxed));
+}
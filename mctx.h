@@ -0,0 +1,38 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file mctx.h
+ * Per-loop memory contexts with lock-free remote frees.
+ *
+ * Every thread (loop) allocates from its own memory context, the objects
+ * are carved from MCTX_SLAB_SIZE slabs that belong to the context.  An
+ * object freed by the owning thread goes straight back to the local free
+ * list.  An object freed by any other thread is pushed onto the owner's
+ * lock-free MPSC return queue, and the owner drains the whole queue at
+ * once when its local free list runs dry, which is the network loop to
+ * worker handoff where the worker frees what the loop has allocated.
+ *
+ * The contexts outlive their threads and are adopted by new threads.  The
+ * slabs and the contexts themselves are the same as in the pool, see
+ * slab.h, only the remote frees differ.
+ */
+
+#include <stddef.h>
+
+#ifndef MCTX_SLAB_SIZE
+#define MCTX_SLAB_SIZE (64 * 1024)
+#endif /* ifndef MCTX_SLAB_SIZE */
+
+void *
+mctx_alloc(size_t size);
+
+void
+mctx_free(void *ptr, size_t size);
+/*%<
+ * 'size' must be the size the object was allocated with.
+ */
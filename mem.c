@@ -0,0 +1,152 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <inttypes.h>
+#include <jemalloc/jemalloc.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "atomic.h"
+#include "mem.h"
+
+#define MIB (1024.0 * 1024.0)
+
+static uv_thread_t sampler;
+static atomic_bool sampler_running;
+static uint64_t sampler_interval;
+static struct mem_sample sampler_peak;
+
+static const char *jemalloc_stats[MEM_MAX] = {
+	[MEM_ALLOCATED] = "stats.allocated",
+	[MEM_ACTIVE] = "stats.active",
+	[MEM_RESIDENT] = "stats.resident",
+	[MEM_RETAINED] = "stats.retained",
+};
+
+static bool
+rss_read(size_t *rss) {
+	FILE *fp = fopen("/proc/self/statm", "r");
+	unsigned long size, resident;
+
+	if (fp == NULL) {
+		return (false);
+	}
+
+	int n = fscanf(fp, "%lu %lu", &size, &resident);
+	fclose(fp);
+	if (n != 2) {
+		return (false);
+	}
+
+	*rss = resident * sysconf(_SC_PAGESIZE);
+
+	return (true);
+}
+
+void
+mem_sample(struct mem_sample *sample) {
+	*sample = (struct mem_sample){ 0 };
+
+	sample->valid[MEM_RSS] = rss_read(&sample->value[MEM_RSS]);
+
+	/* The jemalloc statistics are cached until the epoch is advanced */
+	uint64_t epoch = 1;
+	size_t len = sizeof(epoch);
+	if (mallctl("epoch", &epoch, &len, &epoch, len) != 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < MEM_MAX; i++) {
+		if (jemalloc_stats[i] == NULL) {
+			continue;
+		}
+
+		len = sizeof(sample->value[i]);
+		sample->valid[i] = (mallctl(jemalloc_stats[i], &sample->value[i], &len, NULL, 0) == 0);
+	}
+}
+
+static void
+mem_peak(struct mem_sample *peak, const struct mem_sample *sample) {
+	for (size_t i = 0; i < MEM_MAX; i++) {
+		peak->valid[i] = sample->valid[i];
+		if (sample->value[i] > peak->value[i]) {
+			peak->value[i] = sample->value[i];
+		}
+	}
+}
+
+static void
+sampler_run(void *arg [[maybe_unused]]) {
+	while (atomic_load_acquire(&sampler_running)) {
+		struct mem_sample sample;
+
+		mem_sample(&sample);
+		mem_peak(&sampler_peak, &sample);
+
+		uv_sleep(sampler_interval);
+	}
+}
+
+void
+mem_sampler_start(uint64_t interval_ms) {
+	sampler_peak = (struct mem_sample){ 0 };
+	sampler_interval = interval_ms;
+	atomic_store_release(&sampler_running, true);
+
+	int r = uv_thread_create(&sampler, sampler_run, NULL);
+	assert(r == 0);
+}
+
+void
+mem_sampler_stop(struct mem_sample *peak) {
+	struct mem_sample sample;
+
+	atomic_store_release(&sampler_running, false);
+
+	int r = uv_thread_join(&sampler);
+	assert(r == 0);
+
+	mem_sample(&sample);
+	mem_peak(&sampler_peak, &sample);
+
+	*peak = sampler_peak;
+}
+
+void
+mem_print_header(void) {
+	printf("| %10s | %10s | %10s | %10s | %10s | %10s | %10s | %10s ", "peak rss", "end rss", "post rss",
+	       "peak alloc", "end alloc", "active", "resident", "retained");
+}
+
+static void
+mem_print_one(const struct mem_sample *sample, enum mem_stat stat) {
+	if (!sample->valid[stat]) {
+		printf("| %10s ", "-");
+		return;
+	}
+	printf("| %7.1fMiB ", sample->value[stat] / MIB);
+}
+
+void
+mem_print(const struct mem_sample *peak, const struct mem_sample *end, const struct mem_sample *post) {
+	mem_print_one(peak, MEM_RSS);
+	mem_print_one(end, MEM_RSS);
+	mem_print_one(post, MEM_RSS);
+	mem_print_one(peak, MEM_ALLOCATED);
+	mem_print_one(end, MEM_ALLOCATED);
+	mem_print_one(end, MEM_ACTIVE);
+	mem_print_one(end, MEM_RESIDENT);
+	mem_print_one(end, MEM_RETAINED);
+}
@@ -0,0 +1,59 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file mem.h
+ * Memory footprint sampling: process RSS and the jemalloc statistics.
+ *
+ * A sampler thread polls the footprint while the benchmark threads run
+ * and keeps the peak values, mem_sample() takes a single snapshot, e.g.
+ * of the steady state after the run or after the teardown.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum mem_stat {
+	MEM_RSS = 0,	/*%< Resident set size of the process */
+	MEM_ALLOCATED,	/*%< Bytes allocated by the application */
+	MEM_ACTIVE,	/*%< Bytes in active jemalloc pages */
+	MEM_RESIDENT,	/*%< Bytes in physically resident jemalloc pages */
+	MEM_RETAINED,	/*%< Bytes retained by jemalloc, but not returned to the OS */
+	MEM_MAX,
+};
+
+struct mem_sample {
+	bool valid[MEM_MAX];
+	size_t value[MEM_MAX];
+};
+
+void
+mem_sample(struct mem_sample *sample);
+
+void
+mem_sampler_start(uint64_t interval_ms);
+/*%<
+ * Start the sampler thread, the peak values are reset.
+ */
+
+void
+mem_sampler_stop(struct mem_sample *peak);
+/*%<
+ * Stop the sampler thread and return the peak values seen since
+ * mem_sampler_start(), including a final sample.
+ */
+
+void
+mem_print_header(void);
+
+void
+mem_print(const struct mem_sample *peak, const struct mem_sample *end, const struct mem_sample *post);
+/*%<
+ * Print the peak and end-of-run RSS and allocated bytes, the end-of-run
+ * jemalloc active/resident/retained bytes and the RSS after the teardown.
+ */
@@ -0,0 +1,306 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif /* if defined(__linux__) */
+
+#include "perf.h"
+
+const char *perf_event_names[PERF_MAX] = {
+	[PERF_CYCLES] = "cycles",
+	[PERF_INSTRUCTIONS] = "instr",
+	[PERF_BRANCH_MISSES] = "br-miss",
+	[PERF_L1D_MISSES] = "l1d-miss",
+	[PERF_LLC_MISSES] = "llc-miss",
+	[PERF_HITM] = "hitm",
+	[PERF_CONTEXT_SWITCHES] = "ctx-sw",
+	[PERF_CPU_MIGRATIONS] = "cpu-migr",
+};
+
+static bool perf_on = false;
+static uint64_t perf_hitm = 0;
+
+#if defined(__linux__)
+
+#define CACHE_CONFIG(cache, op, result) \
+	((PERF_COUNT_HW_CACHE_##cache) | (PERF_COUNT_HW_CACHE_OP_##op << 8) | (PERF_COUNT_HW_CACHE_RESULT_##result << 16))
+
+static const struct {
+	enum perf_group group;
+	uint32_t type;
+	uint64_t config;
+} perf_events[PERF_MAX] = {
+	[PERF_CYCLES] = { PERF_GROUP_CORE, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS] = { PERF_GROUP_CORE, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_BRANCH_MISSES] = { PERF_GROUP_CORE, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[PERF_L1D_MISSES] = { PERF_GROUP_CACHE, PERF_TYPE_HW_CACHE, CACHE_CONFIG(L1D, READ, MISS) },
+	[PERF_LLC_MISSES] = { PERF_GROUP_CACHE, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_HITM] = { PERF_GROUP_CACHE, PERF_TYPE_RAW, 0 },
+	[PERF_CONTEXT_SWITCHES] = { PERF_GROUP_SOFTWARE, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	[PERF_CPU_MIGRATIONS] = { PERF_GROUP_SOFTWARE, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+};
+
+static int
+perf_event_open(struct perf_event_attr *attr, int group_fd) {
+	/* pid == 0 and cpu == -1 counts the calling thread on any CPU */
+	return (syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0));
+}
+
+void
+perf_init(bool enabled, uint64_t hitm_event) {
+	perf_on = enabled;
+	perf_hitm = hitm_event;
+
+	if (!perf_on) {
+		return;
+	}
+
+	/* Probe once, so the user knows why the columns are empty */
+	struct perf_counters pc;
+	perf_open(&pc);
+	bool any = false;
+	for (size_t i = 0; i < PERF_MAX; i++) {
+		any = any || pc.fd[i] != -1;
+	}
+	perf_close(&pc);
+
+	if (!any) {
+		fprintf(stderr, "perf_event_open() failed: %s, check /proc/sys/kernel/perf_event_paranoid\n",
+			strerror(errno));
+	}
+}
+
+void
+perf_open(struct perf_counters *pc) {
+	*pc = (struct perf_counters){ 0 };
+
+	for (size_t g = 0; g < PERF_GROUP_MAX; g++) {
+		pc->leader[g] = -1;
+	}
+	for (size_t i = 0; i < PERF_MAX; i++) {
+		pc->fd[i] = -1;
+	}
+
+	if (!perf_on) {
+		return;
+	}
+
+	for (size_t i = 0; i < PERF_MAX; i++) {
+		enum perf_group g = perf_events[i].group;
+		struct perf_event_attr attr = {
+			.size = sizeof(attr),
+			.type = perf_events[i].type,
+			.config = perf_events[i].config,
+			.disabled = (pc->leader[g] == -1),
+			/* Software events happen in the kernel by definition */
+			.exclude_kernel = (g != PERF_GROUP_SOFTWARE),
+			.exclude_hv = 1,
+			.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+				       PERF_FORMAT_TOTAL_TIME_RUNNING,
+		};
+
+		if (i == PERF_HITM) {
+			if (perf_hitm == 0) {
+				continue;
+			}
+			attr.config = perf_hitm;
+		}
+
+		/*
+		 * Unsupported events (ENOENT, EOPNOTSUPP) and forbidden
+		 * events (EACCES, EPERM) are simply left out.
+		 */
+		pc->fd[i] = perf_event_open(&attr, pc->leader[g]);
+		if (pc->fd[i] != -1 && pc->leader[g] == -1) {
+			pc->leader[g] = pc->fd[i];
+		}
+	}
+}
+
+static uint64_t
+thread_csw(void) {
+	struct rusage usage;
+
+	int r = getrusage(RUSAGE_THREAD, &usage);
+	assert(r == 0);
+
+	return (usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+void
+perf_start(struct perf_counters *pc) {
+	if (perf_on && pc->fd[PERF_CONTEXT_SWITCHES] == -1) {
+		/* Fall back to getrusage() when paranoia forbids kernel events */
+		pc->csw = thread_csw();
+	}
+
+	for (size_t g = 0; g < PERF_GROUP_MAX; g++) {
+		if (pc->leader[g] != -1) {
+			(void)ioctl(pc->leader[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			(void)ioctl(pc->leader[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+}
+
+void
+perf_stop(struct perf_counters *pc) {
+	for (size_t g = 0; g < PERF_GROUP_MAX; g++) {
+		if (pc->leader[g] != -1) {
+			(void)ioctl(pc->leader[g], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+
+	if (perf_on && pc->fd[PERF_CONTEXT_SWITCHES] == -1) {
+		pc->csw = thread_csw() - pc->csw;
+	}
+}
+
+void
+perf_close(struct perf_counters *pc) {
+	for (size_t g = 0; g < PERF_GROUP_MAX; g++) {
+		struct {
+			uint64_t nr;
+			uint64_t time_enabled;
+			uint64_t time_running;
+			uint64_t values[PERF_MAX];
+		} buf;
+
+		if (pc->leader[g] == -1) {
+			continue;
+		}
+
+		ssize_t len = read(pc->leader[g], &buf, sizeof(buf));
+		if (len < (ssize_t)(3 * sizeof(uint64_t)) || buf.time_running == 0) {
+			continue;
+		}
+
+		/* Scale the values if the group had to be multiplexed */
+		double scale = (double)buf.time_enabled / buf.time_running;
+
+		/* The values come in the order the group members were opened */
+		size_t n = 0;
+		for (size_t i = 0; i < PERF_MAX && n < buf.nr; i++) {
+			if (perf_events[i].group != g || pc->fd[i] == -1) {
+				continue;
+			}
+			pc->value[i] = (uint64_t)(buf.values[n++] * scale);
+			pc->valid[i] = true;
+		}
+	}
+
+	if (perf_on && pc->fd[PERF_CONTEXT_SWITCHES] == -1) {
+		pc->value[PERF_CONTEXT_SWITCHES] = pc->csw;
+		pc->valid[PERF_CONTEXT_SWITCHES] = true;
+	}
+
+	for (size_t i = 0; i < PERF_MAX; i++) {
+		if (pc->fd[i] != -1) {
+			close(pc->fd[i]);
+			pc->fd[i] = -1;
+		}
+	}
+	for (size_t g = 0; g < PERF_GROUP_MAX; g++) {
+		pc->leader[g] = -1;
+	}
+}
+
+#else /* if defined(__linux__) */
+
+void
+perf_init(bool enabled, uint64_t hitm_event) {
+	(void)hitm_event;
+
+	if (enabled) {
+		fprintf(stderr, "performance counters are supported only on Linux\n");
+	}
+}
+
+void
+perf_open(struct perf_counters *pc) {
+	*pc = (struct perf_counters){ 0 };
+	for (size_t g = 0; g < PERF_GROUP_MAX; g++) {
+		pc->leader[g] = -1;
+	}
+	for (size_t i = 0; i < PERF_MAX; i++) {
+		pc->fd[i] = -1;
+	}
+}
+
+void
+perf_start(struct perf_counters *pc) {
+	(void)pc;
+}
+
+void
+perf_stop(struct perf_counters *pc) {
+	(void)pc;
+}
+
+void
+perf_close(struct perf_counters *pc) {
+	(void)pc;
+}
+
+#endif /* if defined(__linux__) */
+
+bool
+perf_enabled(void) {
+	return (perf_on);
+}
+
+void
+perf_reset(struct perf_counters *pc) {
+	*pc = (struct perf_counters){ 0 };
+	for (size_t i = 0; i < PERF_MAX; i++) {
+		pc->valid[i] = perf_on;
+		pc->fd[i] = -1;
+	}
+	for (size_t g = 0; g < PERF_GROUP_MAX; g++) {
+		pc->leader[g] = -1;
+	}
+}
+
+void
+perf_add(struct perf_counters *sum, const struct perf_counters *pc) {
+	for (size_t i = 0; i < PERF_MAX; i++) {
+		sum->valid[i] = sum->valid[i] && pc->valid[i];
+		sum->value[i] += pc->value[i];
+	}
+}
+
+void
+perf_print_header(void) {
+	for (size_t i = 0; i < PERF_MAX; i++) {
+		printf("| %10s ", perf_event_names[i]);
+	}
+}
+
+void
+perf_print(const struct perf_counters *pc, uint64_t ops) {
+	for (size_t i = 0; i < PERF_MAX; i++) {
+		if (!pc->valid[i] || ops == 0) {
+			printf("| %10s ", "-");
+			continue;
+		}
+		printf("| %10.3f ", (double)pc->value[i] / ops);
+	}
+}
@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*! \file perf.h
+ * Per-thread hardware and software counters via perf_event_open(2).
+ *
+ * Every thread opens its own counter groups with perf_open() before the
+ * start barrier, brackets the measured loop with perf_start() and
+ * perf_stop() and finally collects the values with perf_close().  When
+ * the counters can't be opened (e.g. perf_event_paranoid forbids it or
+ * the PMU doesn't know the event) the affected values are reported as
+ * missing and the benchmark runs as usual.
+ */
+
+enum perf_event {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_BRANCH_MISSES,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_HITM,
+	PERF_CONTEXT_SWITCHES,
+	PERF_CPU_MIGRATIONS,
+	PERF_MAX,
+};
+
+enum perf_group {
+	PERF_GROUP_CORE = 0,
+	PERF_GROUP_CACHE,
+	PERF_GROUP_SOFTWARE,
+	PERF_GROUP_MAX,
+};
+
+struct perf_counters {
+	int fd[PERF_MAX];
+	int leader[PERF_GROUP_MAX];
+	bool valid[PERF_MAX];
+	uint64_t value[PERF_MAX];
+	uint64_t csw;
+};
+
+extern const char *perf_event_names[PERF_MAX];
+
+void
+perf_init(bool enabled, uint64_t hitm_event);
+/*%<
+ * Enable the counters for all threads.  'hitm_event' is the raw PMU event
+ * code counting loads that hit a modified line in another core's cache
+ * (e.g. 0x04d2 MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM on Skylake), 0 when the
+ * HITM counter should not be collected.
+ */
+
+bool
+perf_enabled(void);
+
+void
+perf_open(struct perf_counters *pc);
+
+void
+perf_start(struct perf_counters *pc);
+
+void
+perf_stop(struct perf_counters *pc);
+
+void
+perf_close(struct perf_counters *pc);
+
+void
+perf_add(struct perf_counters *sum, const struct perf_counters *pc);
+/*%<
+ * Accumulate the values from 'pc' into 'sum'.  A counter is valid in
+ * 'sum' only when it was valid in every accumulated thread.
+ */
+
+void
+perf_reset(struct perf_counters *pc);
+
+void
+perf_print_header(void);
+
+void
+perf_print(const struct perf_counters *pc, uint64_t ops);
+/*%<
+ * Print the table columns with the counters normalized per operation.
+ */
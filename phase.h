@@ -0,0 +1,120 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file phase.h
+ * Sampled time attribution to the phases of a benchmark operation.
+ *
+ * Every phase_rate-th operation is sampled: phase_begin() takes the first
+ * timestamp and every phase_mark() attributes the time since the previous
+ * timestamp to the phase that has just ended.  Unsampled operations pay
+ * only for a thread-local flag check.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <threads.h>
+#include <time.h>
+
+enum phase {
+	PHASE_ALLOCATE = 0, /*%< Allocating and filling the node */
+	PHASE_ACQUIRE,	    /*%< Waiting for the lock or entering the read-side */
+	PHASE_CRITICAL,	    /*%< Working inside the critical section */
+	PHASE_RELEASE,	    /*%< Unlocking or leaving the read-side */
+	PHASE_RECLAIM,	    /*%< Freeing the node or deferring its freeing */
+	PHASE_MAX,
+};
+
+struct phases {
+	uint64_t ns[PHASE_MAX];
+	uint64_t samples;
+};
+
+static const char *phase_names[PHASE_MAX] = {
+	[PHASE_ALLOCATE] = "allocate",
+	[PHASE_ACQUIRE] = "acquire",
+	[PHASE_CRITICAL] = "critical",
+	[PHASE_RELEASE] = "release",
+	[PHASE_RECLAIM] = "reclaim",
+};
+
+static uint64_t phase_rate = 0;
+
+static thread_local struct phases *phase_current = NULL;
+static thread_local uint64_t phase_last = 0;
+
+static inline uint64_t
+phase_now(void) {
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static inline void
+phase_begin(struct phases *phases, uint64_t op) {
+	if (phase_rate == 0 || op % phase_rate != 0) {
+		return;
+	}
+
+	phase_current = phases;
+	phase_last = phase_now();
+}
+
+static inline void
+phase_mark(enum phase phase) {
+	if (phase_current == NULL) {
+		return;
+	}
+
+	uint64_t now = phase_now();
+	phase_current->ns[phase] += now - phase_last;
+	phase_last = now;
+}
+
+static inline void
+phase_end(void) {
+	if (phase_current == NULL) {
+		return;
+	}
+
+	phase_current->samples++;
+	phase_current = NULL;
+}
+
+static inline void
+phase_add(struct phases *sum, const struct phases *phases) {
+	for (size_t i = 0; i < PHASE_MAX; i++) {
+		sum->ns[i] += phases->ns[i];
+	}
+	sum->samples += phases->samples;
+}
+
+static inline void
+phase_print_header(void) {
+	for (size_t i = 0; i < PHASE_MAX; i++) {
+		printf("| %10s ", phase_names[i]);
+	}
+}
+
+/*
+ * The phases are printed as average nanoseconds per sampled operation, so
+ * the columns add up to the average sampled operation.
+ */
+static inline void
+phase_print(const struct phases *phases) {
+	for (size_t i = 0; i < PHASE_MAX; i++) {
+		if (phases->samples == 0) {
+			printf("| %10s ", "-");
+			continue;
+		}
+		printf("| %10.1f ", (double)phases->ns[i] / phases->samples);
+	}
+}
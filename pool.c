@@ -0,0 +1,161 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <uv.h>
+
+#include "pool.h"
+#include "slab.h"
+
+struct pool_cache {
+	struct slab_cache slab; /* Must be the first member */
+
+	/* Objects freed by the other threads */
+	alignas(SLAB_CACHELINE_SIZE) uv_mutex_t lock;
+	struct slab_object *remote[SLAB_CLASSES];
+
+	/* The remote frees of this thread that are yet to be handed back */
+	struct pool_cache *batch_owner;
+	size_t batch_class;
+	struct slab_object *batch_head;
+	struct slab_object *batch_tail;
+	size_t batch_len;
+};
+
+static uv_once_t pool_once = UV_ONCE_INIT;
+static struct slab_caches pool_caches;
+static thread_local struct pool_cache *pool_self = NULL;
+
+static void
+pool_batch_flush(struct pool_cache *cache) {
+	struct pool_cache *owner = cache->batch_owner;
+	size_t class = cache->batch_class;
+
+	if (cache->batch_len == 0) {
+		return;
+	}
+
+	uv_mutex_lock(&owner->lock);
+	cache->batch_tail->next = owner->remote[class];
+	owner->remote[class] = cache->batch_head;
+	uv_mutex_unlock(&owner->lock);
+
+	cache->batch_head = NULL;
+	cache->batch_tail = NULL;
+	cache->batch_len = 0;
+}
+
+static void
+pool_thread_exit(void *arg) {
+	struct pool_cache *cache = arg;
+
+	pool_batch_flush(cache);
+	slab_cache_orphan(&pool_caches, &cache->slab);
+}
+
+static void
+pool_initialize(void) {
+	slab_caches_init(&pool_caches, pool_thread_exit);
+}
+
+static void
+pool_cache_init(struct slab_cache *slab) {
+	struct pool_cache *cache = (struct pool_cache *)slab;
+
+	int r = uv_mutex_init(&cache->lock);
+	assert(r == 0);
+}
+
+static struct pool_cache *
+pool_cache_get(void) {
+	struct pool_cache *cache = pool_self;
+
+	if (cache != NULL) {
+		return (cache);
+	}
+
+	uv_once(&pool_once, pool_initialize);
+
+	cache = (struct pool_cache *)slab_cache_adopt(&pool_caches, sizeof(*cache), alignof(struct pool_cache),
+						      pool_cache_init);
+	pool_self = cache;
+
+	return (cache);
+}
+
+void *
+pool_alloc(size_t size) {
+	size_t class = slab_class(size);
+
+	if (class >= SLAB_CLASSES) {
+		return (malloc(size));
+	}
+
+	struct pool_cache *cache = pool_cache_get();
+	struct slab_object *object = cache->slab.free[class];
+
+	if (object == NULL) {
+		/* Take back everything the other threads have freed */
+		uv_mutex_lock(&cache->lock);
+		object = cache->remote[class];
+		cache->remote[class] = NULL;
+		uv_mutex_unlock(&cache->lock);
+
+		if (object == NULL) {
+			slab_new(&cache->slab, class, POOL_SLAB_SIZE);
+			object = cache->slab.free[class];
+		}
+	}
+
+	cache->slab.free[class] = object->next;
+
+	return (object);
+}
+
+void
+pool_free(void *ptr, size_t size) {
+	size_t class = slab_class(size);
+
+	if (class >= SLAB_CLASSES) {
+		free(ptr);
+		return;
+	}
+
+	struct pool_cache *cache = pool_cache_get();
+	struct slab *slab = slab_of(ptr, POOL_SLAB_SIZE);
+	struct pool_cache *owner = (struct pool_cache *)slab->owner;
+	struct slab_object *object = ptr;
+
+	assert(slab->class == class);
+
+	if (owner == cache) {
+		object->next = cache->slab.free[class];
+		cache->slab.free[class] = object;
+		return;
+	}
+
+	if (cache->batch_owner != owner || cache->batch_class != class || cache->batch_len == POOL_REMOTE_BATCH) {
+		pool_batch_flush(cache);
+		cache->batch_owner = owner;
+		cache->batch_class = class;
+	}
+
+	object->next = cache->batch_head;
+	cache->batch_head = object;
+	if (cache->batch_tail == NULL) {
+		cache->batch_tail = object;
+	}
+	cache->batch_len++;
+}
@@ -0,0 +1,47 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file pool.h
+ * Per-thread slab pool for the benchmark nodes.
+ *
+ * The objects are rounded up to whole cache lines and carved from
+ * POOL_SLAB_SIZE slabs that belong to the thread that allocated them.
+ * Every thread allocates from and frees to its own free lists without any
+ * synchronization.  Objects freed by another thread are collected in a
+ * small batch and handed back to the owner under the owner's lock, the
+ * owner takes all of them back at once when its free list runs dry.
+ *
+ * The thread caches outlive their threads: a cache of an exited thread is
+ * adopted by the next new thread, so the remote frees of a thread that has
+ * already exited are not lost.  The memory is never returned to the
+ * system.
+ *
+ * The slab and thread cache code is shared with mctx, see slab.h.
+ */
+
+#include <stddef.h>
+
+#ifndef POOL_SLAB_SIZE
+#define POOL_SLAB_SIZE (64 * 1024)
+#endif /* ifndef POOL_SLAB_SIZE */
+
+/*
+ * Number of remote frees handed back to the owner at once.
+ */
+#ifndef POOL_REMOTE_BATCH
+#define POOL_REMOTE_BATCH 32
+#endif /* ifndef POOL_REMOTE_BATCH */
+
+void *
+pool_alloc(size_t size);
+
+void
+pool_free(void *ptr, size_t size);
+/*%<
+ * 'size' must be the size the object was allocated with.
+ */
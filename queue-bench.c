@@ -13,19 +13,81 @@
 #endif
 
 #include <assert.h>
+#include <getopt.h>
 #include <inttypes.h>
+#include <stdalign.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <threads.h>
 #include <time.h>
-#include <urcu.h>
-#include <urcu/cds.h>
 #include <uv.h>
 
+#include "alloc.h"
+#include "ebr.h"
+#include "elimstack.h"
+#include "fairness.h"
+#include "hp.h"
+#include "hugemem.h"
+#include "lcrq.h"
+#include "lscq.h"
+#include "mem.h"
+#include "perf.h"
+#include "phase.h"
+#include "rcu.h"
+#include "rcustat.h"
 #include "rwlock.h"
+#include "sojourn.h"
+#include "tscache.h"
 #include "util.h"
 
+struct thread_s;
+struct data;
+
+/*
+ * Safe memory reclamation scheme used by the backend, the benchmark
+ * threads register with it and the deferred frees are accounted by
+ * rcustat.
+ */
+enum smr {
+	SMR_NONE = 0,
+	SMR_RCU,
+	SMR_EBR,
+	SMR_HP,
+};
+
+struct test {
+	const char *name;
+	void *(*new)(size_t nelements);
+	struct data *(*alloc)(void);
+	void (*enqueue)(struct thread_s *arg, struct data *data);
+	struct data *(*dequeue)(struct thread_s *arg);
+	void (*reclaim)(struct data *data);
+	void (*destroy)(void *);
+	enum smr smr;
+	/* Optional, the batch mode falls back to the single element ops */
+	void (*enqueue_batch)(struct thread_s *arg, struct data **batch, size_t n);
+	size_t (*dequeue_batch)(struct thread_s *arg, struct data **batch, size_t n);
+	bool lifo; /* A stack, --lifo runs only the stacks */
+};
+
+/*
+ * Batch mode: every op enqueues, or dequeues up to, batch_size elements.
+ */
+#define BATCH_MAX 256
+
+static size_t batch_size; /* Zero without --batch */
+
+/*
+ * The threads either enqueue or dequeue at random, or they are dedicated
+ * producers and consumers.
+ */
+enum role {
+	ROLE_MIXED = 0,
+	ROLE_PRODUCER,
+	ROLE_CONSUMER,
+};
+
 struct thread_s {
 	uv_thread_t thread;
 	uv_mutex_t *mutex;
@@ -33,371 +95,2891 @@ struct thread_s {
 	uv_barrier_t *barrier;
 	rwlock_t *crwwp;
 	uv_thread_cb cb;
+	const struct test *test;
 	uint64_t ops;
+	uint64_t rate;
 	uint64_t reads;
 	uint64_t writes;
 	uint64_t diff;
 	uint8_t rws;
+	enum role role;
 	void *data;
+	struct perf_counters perf;
+	struct phases phases;
+	struct fairness fairness;
+	uint64_t empty;	   /* Dequeues that found the queue empty */
+	uint64_t full;	   /* Enqueues that found the queue full */
+	uint64_t elements; /* Elements moved in the batch mode */
+	uint64_t retries;  /* Dequeues that lost the race for a type-stable node */
+	struct sojourn sojourn;
 };
 
 struct data {
-	uint64_t value; /* Node content */
+	uint64_t value;	   /* Node content, the op number of the producer */
+	uint64_t enqueued; /* Enqueue timestamp, zero for the prefilled nodes */
+	size_t producer;
 	struct cds_list_head head;
 	struct rcu_head rcu_head;
+	struct ebr_head ebr_head;
 	struct cds_lfq_node_rcu node;
+	struct cds_wfcq_node wfcq_node;
+	struct cds_wfs_node wfs_node;
+	struct cds_lfs_node lfs_node;
+	struct elimstack_node elim_node;
+	bool arena; /* Carved from the prefill arena, see prefill_new() */
 };
 
 static uint8_t *rnd;
+struct thread_s *threads;
+static size_t bench_nthreads; /* The number of the threads */
+
+/*
+ * Stall mode: the first thread sleeps for stall_ms in the middle of the
+ * dequeue at the midpoint of its run, while it holds the lock or protects
+ * the node it's looking at.
+ */
+static uint64_t stall_ms;
+static thread_local bool stall_pending;
+
+static inline void
+stall_point(void) {
+	if (stall_pending) {
+		stall_pending = false;
+		uv_sleep(stall_ms);
+	}
+}
+
+/*
+ * Bounded occupancy mode: the queue starts with bounded_occupancy nodes
+ * instead of num_ops per thread, so it keeps running close to empty.  A
+ * dequeue that finds the queue empty polls again, and with a capacity an
+ * enqueue into a full queue waits for a dequeue.  The waiting threads
+ * either spin or park on a condition variable.
+ *
+ * The occupancy is only counted when there's a capacity, the empty queue
+ * is detected by the dequeue itself.
+ */
+#define BOUNDED_PARK_NS (1000 * 1000) /* Upper bound for a missed wakeup */
+
+static bool bounded_enabled;
+static bool bounded_park;
+static uint64_t bounded_occupancy;
+static int_fast64_t bounded_capacity;
+static unsigned int bounded_nthreads;
+static alignas(64) atomic_int_fast64_t bounded_count;
+static alignas(64) atomic_uint bounded_idle; /* Threads waiting or done */
+static alignas(64) atomic_uint bounded_parked;
+static uv_mutex_t bounded_lock;
+static uv_cond_t bounded_cond;
 
 static void
-mutex_queue_run(void *arg0) {
-	struct thread_s *arg = arg0;
-	struct timespec start, end;
-	struct cds_list_head *head = arg->data;
+bounded_wake(void) {
+	if (bounded_park && atomic_load_relaxed(&bounded_parked) != 0) {
+		uv_mutex_lock(&bounded_lock);
+		uv_cond_broadcast(&bounded_cond);
+		uv_mutex_unlock(&bounded_lock);
+	}
+}
 
-	(void)uv_barrier_wait(arg->barrier);
+/*
+ * Give the other threads a chance to change the occupancy.  False when
+ * all the other threads are waiting too or have finished their ops, as
+ * nothing is going to change then.
+ */
+static bool
+bounded_wait(const struct test *test) {
+	bool progress = true;
+
+	if (atomic_fetch_add_relaxed(&bounded_idle, 1) + 1 == bounded_nthreads) {
+		progress = false;
+	} else if (bounded_park) {
+		if (test->smr == SMR_RCU) {
+			rcu_offline();
+		}
+		uv_mutex_lock(&bounded_lock);
+		atomic_fetch_add_relaxed(&bounded_parked, 1);
+		(void)uv_cond_timedwait(&bounded_cond, &bounded_lock, BOUNDED_PARK_NS);
+		atomic_fetch_sub_relaxed(&bounded_parked, 1);
+		uv_mutex_unlock(&bounded_lock);
+		if (test->smr == SMR_RCU) {
+			rcu_online();
+		}
+	} else {
+		pause();
+		if (test->smr == SMR_RCU) {
+			/* The spinning thread holds no references */
+			rcu_quiescent(0);
+		}
+	}
+	atomic_fetch_sub_relaxed(&bounded_idle, 1);
 
-	time_now(&start);
+	return (progress);
+}
 
-	for (size_t i = 0; i < arg->ops; i++) {
-		if (rnd[i]) {
-			arg->writes++;
-			struct data *newdata = malloc(sizeof(*newdata));
-			uv_mutex_lock(arg->mutex);
-			newdata->value = i;
-			cds_list_add_tail(&newdata->head, head);
-			uv_mutex_unlock(arg->mutex);
-		} else {
-			arg->reads++;
-			struct data *data = NULL;
+static void
+bounded_enqueue(struct thread_s *arg, struct data *data) {
+	while (bounded_capacity != 0 && atomic_load_relaxed(&bounded_count) >= bounded_capacity) {
+		arg->full++;
+		if (!bounded_wait(arg->test)) {
+			break;
+		}
+	}
 
-			uv_mutex_lock(arg->mutex);
-			data = cds_list_first_entry(head, struct data, head);
-			if (data == NULL) {
-				uv_mutex_unlock(arg->mutex);
-				continue;
+	arg->test->enqueue(arg, data);
+	if (bounded_capacity != 0) {
+		atomic_fetch_add_relaxed(&bounded_count, 1);
+	}
+	bounded_wake();
+}
+
+static struct data *
+bounded_dequeue(struct thread_s *arg) {
+	for (;;) {
+		struct data *data = arg->test->dequeue(arg);
+		if (data != NULL) {
+			if (bounded_capacity != 0) {
+				atomic_fetch_sub_relaxed(&bounded_count, 1);
+				bounded_wake();
 			}
+			return (data);
+		}
 
-			cds_list_del(&data->head);
-			uv_mutex_unlock(arg->mutex);
+		arg->empty++;
+		if (!bounded_wait(arg->test)) {
+			return (NULL);
+		}
+	}
+}
 
-			/* Do something with **data** */
-			if (data != NULL) {
-				free(data);
-			}
+static void
+bounded_reset(size_t nelements, unsigned int nthreads) {
+	atomic_store_relaxed(&bounded_count, nelements);
+	atomic_store_relaxed(&bounded_idle, 0);
+	bounded_nthreads = nthreads;
+}
+
+static struct data *
+list_first(struct cds_list_head *head) {
+	if (cds_list_empty(head)) {
+		return (NULL);
+	}
+	return (cds_list_first_entry(head, struct data, head));
+}
+
+/*
+ * The batch operations link the nodes into a private chain before they take
+ * the lock, and then append the whole chain at once.  The chain is published
+ * with a single store, so the RCU readers never see a partial chain.
+ */
+static void
+list_link(struct cds_list_head *chain, struct data **batch, size_t n) {
+	CDS_INIT_LIST_HEAD(chain);
+	for (size_t i = 0; i < n; i++) {
+		cds_list_add_tail(&batch[i]->head, chain);
+	}
+}
+
+static void
+list_splice_tail_rcu(struct cds_list_head *chain, struct cds_list_head *head) {
+	struct cds_list_head *first = chain->next;
+	struct cds_list_head *last = chain->prev;
+	struct cds_list_head *prev = head->prev;
+
+	last->next = head;
+	first->prev = prev;
+	head->prev = last;
+	rcu_assign_pointer(prev->next, first);
+}
+
+static size_t
+list_take(struct cds_list_head *head, struct data **batch, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		struct data *data = list_first(head);
+		if (data == NULL) {
+			break;
 		}
+		cds_list_del_rcu(&data->head);
+		batch[i] = data;
 	}
 
-	time_now(&end);
+	return (i);
+}
 
-	arg->diff = time_microdiff(&end, &start);
+static struct data *
+alloc_data(void) {
+	struct data *data = node_alloc(sizeof(struct data));
+	data->arena = false;
+	data->enqueued = 0;
+	return (data);
 }
 
+/*
+ * The prefilled arena nodes are released all at once by the teardown.
+ */
 static void
-rwlock_queue_run(void *arg0) {
-	struct thread_s *arg = arg0;
-	struct timespec start, end;
+release_data(struct data *data) {
+	if (!data->arena) {
+		node_free(data, sizeof(*data));
+	}
+}
+
+static void
+free_data(struct data *data) {
+	release_data(data);
+}
+
+static void
+free_data_rcu(struct rcu_head *rcu_head) {
+	struct data *data = caa_container_of(rcu_head, struct data, rcu_head);
+	rcustat_processed(sizeof(*data));
+	release_data(data);
+}
+
+static void
+free_data_call_rcu(struct data *data) {
+	rcustat_queued(sizeof(*data));
+	call_rcu(&data->rcu_head, free_data_rcu);
+}
+
+/*
+ * The type-stable nodes are reused right away, the readers revalidate the
+ * identity of the node with its generation.
+ */
+static struct tscache *data_cache;
+
+static struct data *
+alloc_data_ts(void) {
+	struct data *data = tscache_alloc(data_cache);
+	data->enqueued = 0;
+	return (data);
+}
+
+static void
+free_data_ts(struct data *data) {
+	tscache_free(data_cache, data);
+}
+
+static void
+free_data_ebr(struct ebr_head *ebr_head) {
+	struct data *data = caa_container_of(ebr_head, struct data, ebr_head);
+	rcustat_processed(sizeof(*data));
+	release_data(data);
+}
+
+static void
+free_data_retire(struct data *data) {
+	rcustat_queued(sizeof(*data));
+	ebr_retire(&data->ebr_head, free_data_ebr);
+}
+
+/*
+ * The backends below mark the end of every phase of the operation with
+ * phase_mark(), the allocation and reclamation phases are marked by the
+ * queue_run() loop.
+ */
+
+static void
+mutex_enqueue(struct thread_s *arg, struct data *newdata) {
 	struct cds_list_head *head = arg->data;
 
-	(void)uv_barrier_wait(arg->barrier);
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_add_tail(&newdata->head, head);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+}
+
+static struct data *
+mutex_dequeue(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct data *data = NULL;
+
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	data = list_first(head);
+	stall_point();
+	if (data != NULL) {
+		cds_list_del(&data->head);
+	}
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+
+	return (data);
+}
+
+/*
+ * Mutex stack: the mutex list with the pushes at the head, the pops are the
+ * same as the mutex list dequeues.
+ */
+static void
+mutex_push(struct thread_s *arg, struct data *newdata) {
+	struct cds_list_head *head = arg->data;
+
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_add(&newdata->head, head);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+}
+
+/*
+ * The chain is linked in reverse, so after the splice the last node of the
+ * batch is on top, just like after n single pushes.
+ */
+static void
+mutex_push_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_list_head *head = arg->data;
+	struct cds_list_head chain;
+
+	CDS_INIT_LIST_HEAD(&chain);
+	for (size_t i = 0; i < n; i++) {
+		cds_list_add(&batch[i]->head, &chain);
+	}
+
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_splice(&chain, head);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+}
+
+/*
+ * The RCU and EBR lists serialize their writers with the same mutex, so
+ * they share the batch operations with the mutex list.
+ */
+static void
+mutex_enqueue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_list_head *head = arg->data;
+	struct cds_list_head chain;
+
+	list_link(&chain, batch, n);
+
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	list_splice_tail_rcu(&chain, head);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+}
+
+static size_t
+mutex_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_list_head *head = arg->data;
+
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	n = list_take(head, batch, n);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+
+	return (n);
+}
+
+static void
+rwlock_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct cds_list_head *head = arg->data;
+
+	pthread_rwlock_wrlock(arg->rwlock);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_add_tail(&newdata->head, head);
+	phase_mark(PHASE_CRITICAL);
+	pthread_rwlock_unlock(arg->rwlock);
+	phase_mark(PHASE_RELEASE);
+}
+
+static struct data *
+rwlock_dequeue(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct data *data;
+
+	pthread_rwlock_rdlock(arg->rwlock);
+	phase_mark(PHASE_ACQUIRE);
+	data = list_first(head);
+	stall_point();
+	phase_mark(PHASE_CRITICAL);
+	pthread_rwlock_unlock(arg->rwlock);
+	phase_mark(PHASE_RELEASE);
+	if (data == NULL) {
+		return (NULL);
+	}
+
+	pthread_rwlock_wrlock(arg->rwlock);
+	phase_mark(PHASE_ACQUIRE);
+	data = list_first(head);
+	if (data != NULL) {
+		cds_list_del_rcu(&data->head);
+	}
+	phase_mark(PHASE_CRITICAL);
+	pthread_rwlock_unlock(arg->rwlock);
+	phase_mark(PHASE_RELEASE);
+
+	return (data);
+}
+
+static void
+rwlock_enqueue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_list_head *head = arg->data;
+	struct cds_list_head chain;
+
+	list_link(&chain, batch, n);
+
+	pthread_rwlock_wrlock(arg->rwlock);
+	phase_mark(PHASE_ACQUIRE);
+	list_splice_tail_rcu(&chain, head);
+	phase_mark(PHASE_CRITICAL);
+	pthread_rwlock_unlock(arg->rwlock);
+	phase_mark(PHASE_RELEASE);
+}
+
+static size_t
+rwlock_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_list_head *head = arg->data;
+
+	pthread_rwlock_wrlock(arg->rwlock);
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	n = list_take(head, batch, n);
+	phase_mark(PHASE_CRITICAL);
+	pthread_rwlock_unlock(arg->rwlock);
+	phase_mark(PHASE_RELEASE);
+
+	return (n);
+}
+
+static void
+crwwp_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct cds_list_head *head = arg->data;
+
+	rwlock_wrlock(arg->crwwp);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_add_tail(&newdata->head, head);
+	phase_mark(PHASE_CRITICAL);
+	rwlock_wrunlock(arg->crwwp);
+	phase_mark(PHASE_RELEASE);
+}
+
+static struct data *
+crwwp_dequeue(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct data *data;
+
+	rwlock_rdlock(arg->crwwp);
+	phase_mark(PHASE_ACQUIRE);
+	data = list_first(head);
+	stall_point();
+	if (data == NULL) {
+		phase_mark(PHASE_CRITICAL);
+		rwlock_rdunlock(arg->crwwp);
+		phase_mark(PHASE_RELEASE);
+		return (NULL);
+	}
+
+	int r = rwlock_tryupgrade(arg->crwwp);
+	if (r != 0) {
+		assert(r == EBUSY);
+		phase_mark(PHASE_CRITICAL);
+		rwlock_rdunlock(arg->crwwp);
+		phase_mark(PHASE_RELEASE);
+		rwlock_wrlock(arg->crwwp);
+		phase_mark(PHASE_ACQUIRE);
+		data = list_first(head);
+	}
+
+	if (data != NULL) {
+		cds_list_del_rcu(&data->head);
+	}
+	phase_mark(PHASE_CRITICAL);
+	rwlock_wrunlock(arg->crwwp);
+	phase_mark(PHASE_RELEASE);
+
+	return (data);
+}
+
+static void
+crwwp_enqueue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_list_head *head = arg->data;
+	struct cds_list_head chain;
+
+	list_link(&chain, batch, n);
+
+	rwlock_wrlock(arg->crwwp);
+	phase_mark(PHASE_ACQUIRE);
+	list_splice_tail_rcu(&chain, head);
+	phase_mark(PHASE_CRITICAL);
+	rwlock_wrunlock(arg->crwwp);
+	phase_mark(PHASE_RELEASE);
+}
+
+static size_t
+crwwp_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_list_head *head = arg->data;
+
+	rwlock_wrlock(arg->crwwp);
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	n = list_take(head, batch, n);
+	phase_mark(PHASE_CRITICAL);
+	rwlock_wrunlock(arg->crwwp);
+	phase_mark(PHASE_RELEASE);
+
+	return (n);
+}
+
+static void
+rcu_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct cds_list_head *head = arg->data;
+
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	cds_list_add_tail_rcu(&newdata->head, head);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+}
+
+static struct data *
+rcu_dequeue(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct data *data;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	data = list_first(head);
+	stall_point();
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+	if (data == NULL) {
+		return (NULL);
+	}
+
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	data = list_first(head);
+	if (data != NULL) {
+		cds_list_del(&data->head);
+	}
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+
+	return (data);
+}
+
+/*
+ * The type-stable nodes can be freed and reused while the reader looks at
+ * them, so the reader validates the payload it has read with the node
+ * generation, and the writer checks that the node is still the same one
+ * the reader has validated.  A node that has changed is a lost race, the
+ * dequeue starts over.
+ */
+static struct data *
+rcu_ts_dequeue(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct data *data;
+	uint64_t generation = 0, value = 0;
+
+again:
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	data = list_first(head);
+	if (data != NULL) {
+		generation = tscache_generation(data);
+		value = __atomic_load_n(&data->value, __ATOMIC_RELAXED);
+		/* The payload must be read before the generation is checked again */
+		atomic_thread_fence(memory_order_acquire);
+	}
+	stall_point();
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+	if (data == NULL) {
+		return (NULL);
+	}
+	if (tscache_generation(data) != generation) {
+		/* Reused while we were reading it */
+		arg->retries++;
+		goto again;
+	}
+
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	bool lost = (list_first(head) != data || tscache_generation(data) != generation);
+	if (!lost) {
+		/* Still the node we have validated */
+		assert(data->value == value);
+		cds_list_del(&data->head);
+	}
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+
+	if (lost) {
+		arg->retries++;
+		goto again;
+	}
+
+	return (data);
+}
+
+static struct data *
+ebr_dequeue(struct thread_s *arg) {
+	struct cds_list_head *head = arg->data;
+	struct data *data;
+
+	ebr_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	data = list_first(head);
+	stall_point();
+	phase_mark(PHASE_CRITICAL);
+	ebr_read_unlock();
+	phase_mark(PHASE_RELEASE);
+	if (data == NULL) {
+		return (NULL);
+	}
+
+	uv_mutex_lock(arg->mutex);
+	phase_mark(PHASE_ACQUIRE);
+	data = list_first(head);
+	if (data != NULL) {
+		cds_list_del(&data->head);
+	}
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(arg->mutex);
+	phase_mark(PHASE_RELEASE);
+
+	return (data);
+}
+
+static void
+lfqueue_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct cds_lfq_queue_rcu *queue = arg->data;
+
+	cds_lfq_node_init_rcu(&newdata->node);
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	cds_lfq_enqueue_rcu(queue, &newdata->node);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+}
+
+static struct data *
+lfqueue_dequeue(struct thread_s *arg) {
+	struct cds_lfq_queue_rcu *queue = arg->data;
+	struct cds_lfq_node_rcu *node = NULL;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	node = cds_lfq_dequeue_rcu(queue);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+
+	return ((node != NULL) ? caa_container_of(node, struct data, node) : NULL);
+}
+
+static void
+lfqueue_enqueue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_lfq_queue_rcu *queue = arg->data;
+
+	/*
+	 * The whole chain goes in with a single enqueue of its first node,
+	 * then the tail is swung from the first node to the last one, like in
+	 * msqueue_push().  If that fails, other enqueuers have already started
+	 * walking the tail along the chain.
+	 */
+	for (size_t i = 0; i < n; i++) {
+		cds_lfq_node_init_rcu(&batch[i]->node);
+	}
+	for (size_t i = 0; i + 1 < n; i++) {
+		batch[i]->node.next = &batch[i + 1]->node;
+	}
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	cds_lfq_enqueue_rcu(queue, &batch[0]->node);
+	(void)uatomic_cmpxchg(&queue->tail, &batch[0]->node, &batch[n - 1]->node);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+}
+
+static size_t
+lfqueue_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_lfq_queue_rcu *queue = arg->data;
+	size_t i;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	for (i = 0; i < n; i++) {
+		struct cds_lfq_node_rcu *node = cds_lfq_dequeue_rcu(queue);
+		if (node == NULL) {
+			break;
+		}
+		batch[i] = caa_container_of(node, struct data, node);
+	}
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+
+	return (i);
+}
+
+/*
+ * Wait-free concurrent queue: the enqueue is a single exchange on the tail,
+ * the dequeues are serialized by the mutex in the queue head.  The batch
+ * variant ("wfcq-batch") takes the whole queue with a single splice into a
+ * private per-thread queue, and then dequeues from it without any
+ * synchronization, which is how an event loop drains its mailbox.  The
+ * nodes already spliced are invisible to the other consumers.
+ */
+struct wfcq_batch {
+	alignas(64) struct __cds_wfcq_head head;
+	struct cds_wfcq_tail tail;
+};
+
+struct wfcq {
+	alignas(64) struct cds_wfcq_head head;
+	alignas(64) struct cds_wfcq_tail tail;
+	struct wfcq_batch *batches; /* One per thread */
+};
+
+static void
+wfcq_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct wfcq *queue = arg->data;
+
+	cds_wfcq_node_init(&newdata->wfcq_node);
+
+	phase_mark(PHASE_ACQUIRE);
+	(void)cds_wfcq_enqueue(&queue->head, &queue->tail, &newdata->wfcq_node);
+	phase_mark(PHASE_CRITICAL);
+}
+
+static struct data *
+wfcq_dequeue(struct thread_s *arg) {
+	struct wfcq *queue = arg->data;
+	struct cds_wfcq_node *node = NULL;
+
+	cds_wfcq_dequeue_lock(&queue->head, &queue->tail);
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	node = __cds_wfcq_dequeue_blocking(&queue->head, &queue->tail);
+	phase_mark(PHASE_CRITICAL);
+	cds_wfcq_dequeue_unlock(&queue->head, &queue->tail);
+	phase_mark(PHASE_RELEASE);
+
+	return ((node != NULL) ? caa_container_of(node, struct data, wfcq_node) : NULL);
+}
+
+static void
+wfcq_enqueue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct wfcq *queue = arg->data;
+	struct __cds_wfcq_head chain_head;
+	struct cds_wfcq_tail chain_tail;
+
+	__cds_wfcq_init(&chain_head, &chain_tail);
+	for (size_t i = 0; i < n; i++) {
+		cds_wfcq_node_init(&batch[i]->wfcq_node);
+		(void)cds_wfcq_enqueue(&chain_head, &chain_tail, &batch[i]->wfcq_node);
+	}
+
+	/* The chain is private, so the splice needs no lock */
+	phase_mark(PHASE_ACQUIRE);
+	(void)__cds_wfcq_splice_blocking(&queue->head, &queue->tail, &chain_head, &chain_tail);
+	phase_mark(PHASE_CRITICAL);
+}
+
+static size_t
+wfcq_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct wfcq *queue = arg->data;
+	size_t i;
+
+	cds_wfcq_dequeue_lock(&queue->head, &queue->tail);
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	for (i = 0; i < n; i++) {
+		struct cds_wfcq_node *node = __cds_wfcq_dequeue_blocking(&queue->head, &queue->tail);
+		if (node == NULL) {
+			break;
+		}
+		batch[i] = caa_container_of(node, struct data, wfcq_node);
+	}
+	phase_mark(PHASE_CRITICAL);
+	cds_wfcq_dequeue_unlock(&queue->head, &queue->tail);
+	phase_mark(PHASE_RELEASE);
+
+	return (i);
+}
+
+static void
+wfcq_splice(struct wfcq *queue, struct wfcq_batch *local) {
+	cds_wfcq_dequeue_lock(&queue->head, &queue->tail);
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	(void)__cds_wfcq_splice_blocking(&local->head, &local->tail, &queue->head, &queue->tail);
+	phase_mark(PHASE_CRITICAL);
+	cds_wfcq_dequeue_unlock(&queue->head, &queue->tail);
+	phase_mark(PHASE_RELEASE);
+}
+
+static struct data *
+wfcq_batch_dequeue(struct thread_s *arg) {
+	struct wfcq *queue = arg->data;
+	struct wfcq_batch *local = &queue->batches[arg - threads];
+	struct cds_wfcq_node *node = __cds_wfcq_dequeue_blocking(&local->head, &local->tail);
+
+	if (node == NULL) {
+		wfcq_splice(queue, local);
+		node = __cds_wfcq_dequeue_blocking(&local->head, &local->tail);
+	}
+
+	return ((node != NULL) ? caa_container_of(node, struct data, wfcq_node) : NULL);
+}
+
+static size_t
+wfcq_batch_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct wfcq *queue = arg->data;
+	struct wfcq_batch *local = &queue->batches[arg - threads];
+	bool spliced = false;
+	size_t i = 0;
+
+	while (i < n) {
+		struct cds_wfcq_node *node = __cds_wfcq_dequeue_blocking(&local->head, &local->tail);
+		if (node == NULL) {
+			if (spliced) {
+				break;
+			}
+			wfcq_splice(queue, local);
+			spliced = true;
+			continue;
+		}
+		batch[i++] = caa_container_of(node, struct data, wfcq_node);
+	}
+
+	return (i);
+}
+
+/*
+ * Wait-free stack: the push is a single exchange, the pops are serialized
+ * by the stack mutex.
+ */
+static void
+wfstack_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct cds_wfs_stack *stack = arg->data;
+
+	cds_wfs_node_init(&newdata->wfs_node);
+
+	phase_mark(PHASE_ACQUIRE);
+	(void)cds_wfs_push(stack, &newdata->wfs_node);
+	phase_mark(PHASE_CRITICAL);
+}
+
+static struct data *
+wfstack_dequeue(struct thread_s *arg) {
+	struct cds_wfs_stack *stack = arg->data;
+	struct cds_wfs_node *node = NULL;
+
+	cds_wfs_pop_lock(stack);
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	node = __cds_wfs_pop_blocking(stack);
+	phase_mark(PHASE_CRITICAL);
+	cds_wfs_pop_unlock(stack);
+	phase_mark(PHASE_RELEASE);
+
+	return ((node != NULL) ? caa_container_of(node, struct data, wfs_node) : NULL);
+}
+
+static size_t
+wfstack_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_wfs_stack *stack = arg->data;
+	size_t i;
+
+	cds_wfs_pop_lock(stack);
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	for (i = 0; i < n; i++) {
+		struct cds_wfs_node *node = __cds_wfs_pop_blocking(stack);
+		if (node == NULL) {
+			break;
+		}
+		batch[i] = caa_container_of(node, struct data, wfs_node);
+	}
+	phase_mark(PHASE_CRITICAL);
+	cds_wfs_pop_unlock(stack);
+	phase_mark(PHASE_RELEASE);
+
+	return (i);
+}
+
+/*
+ * Lock-free stack: the pops don't take the mutex, RCU protects them from
+ * ABA and from dereferencing a freed node.
+ */
+static void
+lfstack_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct cds_lfs_stack *stack = arg->data;
+
+	cds_lfs_node_init(&newdata->lfs_node);
+
+	phase_mark(PHASE_ACQUIRE);
+	(void)cds_lfs_push(stack, &newdata->lfs_node);
+	phase_mark(PHASE_CRITICAL);
+}
+
+static struct data *
+lfstack_dequeue(struct thread_s *arg) {
+	struct cds_lfs_stack *stack = arg->data;
+	struct cds_lfs_node *node = NULL;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	node = __cds_lfs_pop(stack);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+
+	return ((node != NULL) ? caa_container_of(node, struct data, lfs_node) : NULL);
+}
+
+static size_t
+lfstack_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct cds_lfs_stack *stack = arg->data;
+	size_t i;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	for (i = 0; i < n; i++) {
+		struct cds_lfs_node *node = __cds_lfs_pop(stack);
+		if (node == NULL) {
+			break;
+		}
+		batch[i] = caa_container_of(node, struct data, lfs_node);
+	}
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+
+	return (i);
+}
+
+/*
+ * Elimination-backoff stack: the lfstack with an elimination array, the
+ * pops dereference the top node, so they run under RCU like the lfstack
+ * pops.
+ */
+static void
+elimstack_bench_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct elimstack *stack = arg->data;
+
+	phase_mark(PHASE_ACQUIRE);
+	elimstack_push(stack, &newdata->elim_node);
+	phase_mark(PHASE_CRITICAL);
+}
+
+static struct data *
+elimstack_bench_dequeue(struct thread_s *arg) {
+	struct elimstack *stack = arg->data;
+	struct elimstack_node *node = NULL;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	node = elimstack_pop(stack);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+
+	return ((node != NULL) ? caa_container_of(node, struct data, elim_node) : NULL);
+}
+
+/*
+ * Michael-Scott lock-free queue with hazard pointers.  The queue nodes are
+ * separate from the data, because the dequeued node stays in the queue as
+ * the new dummy node.
+ */
+struct msqueue_node {
+	struct msqueue_node *_Atomic next;
+	struct data *data;
+	struct hp_head hp_head;
+};
+
+struct msqueue {
+	alignas(64) struct msqueue_node *_Atomic head;
+	alignas(64) struct msqueue_node *_Atomic tail;
+};
+
+static void
+free_msqueue_node(struct hp_head *hp_head) {
+	struct msqueue_node *node = caa_container_of(hp_head, struct msqueue_node, hp_head);
+	rcustat_processed(sizeof(*node));
+	node_free(node, sizeof(*node));
+}
+
+static struct msqueue_node *
+msqueue_node_new(struct data *data) {
+	struct msqueue_node *node = node_alloc(sizeof(*node));
+	atomic_init(&node->next, NULL);
+	node->data = data;
+
+	return (node);
+}
+
+/*
+ * Append the chain of nodes from 'first' to 'last'.  The tail is swung to
+ * 'last' directly, if that fails the other threads walk it along the chain.
+ */
+static void
+msqueue_push(struct msqueue *queue, struct msqueue_node *first, struct msqueue_node *last) {
+	for (;;) {
+		struct msqueue_node *tail = hp_protect(0, (void *_Atomic *)&queue->tail);
+		struct msqueue_node *next = atomic_load_acquire(&tail->next);
+
+		if (tail != atomic_load_acquire(&queue->tail)) {
+			continue;
+		}
+
+		if (next != NULL) {
+			/* Help the lagging enqueuer */
+			(void)atomic_compare_exchange_strong(&queue->tail, &tail, next);
+			continue;
+		}
+
+		if (atomic_compare_exchange_strong(&tail->next, &next, first)) {
+			(void)atomic_compare_exchange_strong(&queue->tail, &tail, last);
+			break;
+		}
+	}
+
+	hp_clear();
+}
+
+static void
+msqueue_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct msqueue *queue = arg->data;
+	struct msqueue_node *node = msqueue_node_new(newdata);
+	phase_mark(PHASE_ALLOCATE);
+
+	msqueue_push(queue, node, node);
+	phase_mark(PHASE_CRITICAL);
+}
+
+static void
+msqueue_enqueue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct msqueue *queue = arg->data;
+	struct msqueue_node *first = msqueue_node_new(batch[0]);
+	struct msqueue_node *last = first;
+
+	for (size_t i = 1; i < n; i++) {
+		struct msqueue_node *node = msqueue_node_new(batch[i]);
+		atomic_store_relaxed(&last->next, node);
+		last = node;
+	}
+	phase_mark(PHASE_ALLOCATE);
+
+	msqueue_push(queue, first, last);
+	phase_mark(PHASE_CRITICAL);
+}
+
+static struct data *
+msqueue_dequeue(struct thread_s *arg) {
+	struct msqueue *queue = arg->data;
+	struct msqueue_node *head, *next;
+	struct data *data;
+
+	for (;;) {
+		head = hp_protect(0, (void *_Atomic *)&queue->head);
+		struct msqueue_node *tail = atomic_load_acquire(&queue->tail);
+		next = hp_protect(1, (void *_Atomic *)&head->next);
+
+		if (head != atomic_load_acquire(&queue->head)) {
+			continue;
+		}
+
+		if (next == NULL) {
+			hp_clear();
+			phase_mark(PHASE_CRITICAL);
+			return (NULL);
+		}
+
+		if (head == tail) {
+			(void)atomic_compare_exchange_strong(&queue->tail, &tail, next);
+			continue;
+		}
+
+		data = next->data;
+		stall_point();
+		if (atomic_compare_exchange_strong(&queue->head, &head, next)) {
+			break;
+		}
+	}
+
+	hp_clear();
+	phase_mark(PHASE_CRITICAL);
+
+	rcustat_queued(sizeof(*head));
+	hp_retire(&head->hp_head, head, free_msqueue_node);
+	phase_mark(PHASE_RECLAIM);
+
+	return (data);
+}
+
+/*
+ * LCRQ and LSCQ keep just the pointers to the nodes in their ring
+ * segments, so the dequeued nodes can be freed right away.  Only the
+ * drained segments are freed with call_rcu().
+ */
+#if HAVE_LCRQ
+static void
+lcrq_bench_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct lcrq *lcrq = arg->data;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	lcrq_enqueue(lcrq, newdata);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+}
+
+static struct data *
+lcrq_bench_dequeue(struct thread_s *arg) {
+	struct lcrq *lcrq = arg->data;
+	struct data *data = NULL;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	data = lcrq_dequeue(lcrq);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+
+	return (data);
+}
+#endif /* HAVE_LCRQ */
+
+static void
+lscq_bench_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct lscq *lscq = arg->data;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	lscq_enqueue(lscq, newdata);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+}
+
+static struct data *
+lscq_bench_dequeue(struct thread_s *arg) {
+	struct lscq *lscq = arg->data;
+	struct data *data = NULL;
+
+	rcu_read_lock();
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	data = lscq_dequeue(lscq);
+	phase_mark(PHASE_CRITICAL);
+	rcu_read_unlock();
+	phase_mark(PHASE_RELEASE);
+
+	return (data);
+}
+
+/*
+ * Sharded queue: every thread has its own sub-queue, the enqueues always
+ * go to the local one and the dequeues take from the local one first.  A
+ * thread with an empty sub-queue steals from the others, starting at a
+ * random victim, so the queue is FIFO only per shard.
+ */
+struct shard {
+	alignas(64) uv_mutex_t lock;
+	struct cds_list_head head;
+	atomic_size_t count; /* For the unlocked peek of the thieves */
+};
+
+struct sharded {
+	struct shard *shards;
+	size_t nshards;
+};
+
+static thread_local bool shard_seeded;
+
+static size_t
+sharded_take(struct shard *shard, struct data **batch, size_t n) {
+	if (atomic_load_relaxed(&shard->count) == 0) {
+		return (0);
+	}
+
+	uv_mutex_lock(&shard->lock);
+	phase_mark(PHASE_ACQUIRE);
+	stall_point();
+	n = list_take(&shard->head, batch, n);
+	atomic_store_relaxed(&shard->count, atomic_load_relaxed(&shard->count) - n);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(&shard->lock);
+	phase_mark(PHASE_RELEASE);
+
+	return (n);
+}
+
+static size_t
+sharded_steal(struct sharded *sharded, size_t self, struct data **batch, size_t n) {
+	if (!shard_seeded) {
+		random_init();
+		shard_seeded = true;
+	}
+
+	size_t victim = next() % sharded->nshards;
+	for (size_t i = 0; i < sharded->nshards; i++, victim = (victim + 1) % sharded->nshards) {
+		if (victim == self) {
+			continue;
+		}
+
+		size_t stolen = sharded_take(&sharded->shards[victim], batch, n);
+		if (stolen > 0) {
+			return (stolen);
+		}
+	}
+
+	return (0);
+}
+
+static void
+sharded_enqueue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct sharded *sharded = arg->data;
+	struct shard *shard = &sharded->shards[arg - threads];
+	struct cds_list_head chain;
+
+	list_link(&chain, batch, n);
+
+	uv_mutex_lock(&shard->lock);
+	phase_mark(PHASE_ACQUIRE);
+	list_splice_tail_rcu(&chain, &shard->head);
+	atomic_store_relaxed(&shard->count, atomic_load_relaxed(&shard->count) + n);
+	phase_mark(PHASE_CRITICAL);
+	uv_mutex_unlock(&shard->lock);
+	phase_mark(PHASE_RELEASE);
+}
+
+static size_t
+sharded_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct sharded *sharded = arg->data;
+	size_t self = arg - threads;
+	size_t taken = sharded_take(&sharded->shards[self], batch, n);
+
+	if (taken == 0) {
+		taken = sharded_steal(sharded, self, batch, n);
+	}
+
+	return (taken);
+}
+
+static void
+sharded_enqueue(struct thread_s *arg, struct data *newdata) {
+	sharded_enqueue_batch(arg, &newdata, 1);
+}
+
+static struct data *
+sharded_dequeue(struct thread_s *arg) {
+	struct data *data = NULL;
+
+	return ((sharded_dequeue_batch(arg, &data, 1) > 0) ? data : NULL);
+}
+
+/*
+ * Bounded MPMC ring buffer (Vyukov): every slot has a sequence number that
+ * tells whose turn it is.  A slot at position 'pos' is free for the
+ * producer when its sequence is 'pos', and holds an element for the
+ * consumer when its sequence is 'pos + 1'.  The producers and consumers
+ * only contend on the head or tail counter and never touch each other's
+ * slots, so there's no allocation and no reclamation in the queue itself.
+ *
+ * The slots are either pointers to the nodes ("ring"), or the payload is
+ * copied inline into the slot ("ring-zero"), so no node is allocated
+ * at all.
+ */
+struct ring_slot {
+	atomic_size_t seq;
+};
+
+struct ring_ptr_slot {
+	struct ring_slot slot;
+	struct data *data;
+};
+
+struct ring_inline_slot {
+	struct ring_slot slot;
+	uint64_t value;
+	uint64_t enqueued;
+	size_t producer;
+};
+
+struct ring {
+	size_t mask;
+	size_t slot_size;
+	uint8_t *slots;
+	alignas(64) atomic_size_t head;
+	alignas(64) atomic_size_t tail;
+};
+
+/* The ring never fills up in the unbounded mode */
+static size_t ring_headroom;
+
+/*
+ * The "ring-zero" payload is copied in from and out to the thread-local
+ * scratch nodes, there's enough of them for a whole batch.
+ */
+static thread_local struct data ring_in[BATCH_MAX], ring_out[BATCH_MAX];
+static thread_local size_t ring_in_next, ring_out_next;
+
+static struct ring_slot *
+ring_slot(struct ring *ring, size_t pos) {
+	return ((struct ring_slot *)(ring->slots + (pos & ring->mask) * ring->slot_size));
+}
+
+/*
+ * Claim the slot for the next element, NULL if the ring is full.  The
+ * element must be published with ring_publish() afterwards.
+ */
+static struct ring_slot *
+ring_claim(struct ring *ring, size_t *posp) {
+	size_t pos = atomic_load_relaxed(&ring->tail);
+
+	for (;;) {
+		struct ring_slot *slot = ring_slot(ring, pos);
+		intptr_t diff = (intptr_t)atomic_load_acquire(&slot->seq) - (intptr_t)pos;
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_relaxed(&ring->tail, &pos, pos + 1)) {
+				*posp = pos;
+				return (slot);
+			}
+		} else if (diff < 0) {
+			return (NULL);
+		} else {
+			pos = atomic_load_relaxed(&ring->tail);
+		}
+	}
+}
+
+static void
+ring_publish(struct ring_slot *slot, size_t pos) {
+	atomic_store_release(&slot->seq, pos + 1);
+}
+
+/*
+ * Take the slot with the oldest element, NULL if the ring is empty.  The
+ * slot must be handed back with ring_release() afterwards.
+ */
+static struct ring_slot *
+ring_take(struct ring *ring, size_t *posp) {
+	size_t pos = atomic_load_relaxed(&ring->head);
+
+	for (;;) {
+		struct ring_slot *slot = ring_slot(ring, pos);
+		intptr_t diff = (intptr_t)atomic_load_acquire(&slot->seq) - (intptr_t)(pos + 1);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_relaxed(&ring->head, &pos, pos + 1)) {
+				*posp = pos;
+				return (slot);
+			}
+		} else if (diff < 0) {
+			return (NULL);
+		} else {
+			pos = atomic_load_relaxed(&ring->head);
+		}
+	}
+}
+
+/*
+ * Claim up to 'n' consecutive slots with a single compare-and-swap, zero if
+ * the ring is full.  The position of the first slot is returned in *posp.
+ */
+static size_t
+ring_claim_many(struct ring *ring, size_t *posp, size_t n) {
+	size_t pos = atomic_load_relaxed(&ring->tail);
+
+	for (;;) {
+		intptr_t diff = (intptr_t)atomic_load_acquire(&ring_slot(ring, pos)->seq) - (intptr_t)pos;
+
+		if (diff < 0) {
+			return (0);
+		} else if (diff > 0) {
+			pos = atomic_load_relaxed(&ring->tail);
+			continue;
+		}
+
+		/* Nobody else can claim the following free slots until the tail moves */
+		size_t k = 1;
+		while (k < n && atomic_load_acquire(&ring_slot(ring, pos + k)->seq) == pos + k) {
+			k++;
+		}
+
+		if (atomic_compare_exchange_weak_relaxed(&ring->tail, &pos, pos + k)) {
+			*posp = pos;
+			return (k);
+		}
+	}
+}
+
+/*
+ * Take up to 'n' consecutive slots with a single compare-and-swap, zero if
+ * the ring is empty.  The position of the first slot is returned in *posp.
+ */
+static size_t
+ring_take_many(struct ring *ring, size_t *posp, size_t n) {
+	size_t pos = atomic_load_relaxed(&ring->head);
+
+	for (;;) {
+		intptr_t diff = (intptr_t)atomic_load_acquire(&ring_slot(ring, pos)->seq) - (intptr_t)(pos + 1);
+
+		if (diff < 0) {
+			return (0);
+		} else if (diff > 0) {
+			pos = atomic_load_relaxed(&ring->head);
+			continue;
+		}
+
+		size_t k = 1;
+		while (k < n && atomic_load_acquire(&ring_slot(ring, pos + k)->seq) == pos + k + 1) {
+			k++;
+		}
+
+		if (atomic_compare_exchange_weak_relaxed(&ring->head, &pos, pos + k)) {
+			*posp = pos;
+			return (k);
+		}
+	}
+}
+
+static size_t
+ring_claim_many_wait(struct ring *ring, size_t *posp, size_t n) {
+	size_t k;
+
+	while ((k = ring_claim_many(ring, posp, n)) == 0) {
+		pause();
+	}
+
+	return (k);
+}
+
+static void
+ring_release(struct ring *ring, struct ring_slot *slot, size_t pos) {
+	atomic_store_release(&slot->seq, pos + ring->mask + 1);
+}
+
+static struct ring_slot *
+ring_claim_wait(struct ring *ring, size_t *posp) {
+	struct ring_slot *slot;
+
+	while ((slot = ring_claim(ring, posp)) == NULL) {
+		/* Only with a --capacity larger than the ring */
+		pause();
+	}
+
+	return (slot);
+}
+
+static void
+ring_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct ring *ring = arg->data;
+	size_t pos;
+
+	struct ring_ptr_slot *slot = (struct ring_ptr_slot *)ring_claim_wait(ring, &pos);
+	phase_mark(PHASE_ACQUIRE);
+
+	slot->data = newdata;
+	ring_publish(&slot->slot, pos);
+	phase_mark(PHASE_CRITICAL);
+}
+
+static struct data *
+ring_dequeue(struct thread_s *arg) {
+	struct ring *ring = arg->data;
+	size_t pos;
+
+	struct ring_ptr_slot *slot = (struct ring_ptr_slot *)ring_take(ring, &pos);
+	phase_mark(PHASE_ACQUIRE);
+	if (slot == NULL) {
+		/* The same phases as a successful dequeue */
+		phase_mark(PHASE_CRITICAL);
+		return (NULL);
+	}
+
+	struct data *data = slot->data;
+	stall_point();
+	ring_release(ring, &slot->slot, pos);
+	phase_mark(PHASE_CRITICAL);
+
+	return (data);
+}
+
+static void
+ring_enqueue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct ring *ring = arg->data;
+
+	for (size_t i = 0; i < n;) {
+		size_t pos;
+		size_t k = ring_claim_many_wait(ring, &pos, n - i);
+		phase_mark(PHASE_ACQUIRE);
+
+		for (size_t j = 0; j < k; j++) {
+			struct ring_ptr_slot *slot = (struct ring_ptr_slot *)ring_slot(ring, pos + j);
+			slot->data = batch[i + j];
+			ring_publish(&slot->slot, pos + j);
+		}
+		phase_mark(PHASE_CRITICAL);
+		i += k;
+	}
+}
+
+static size_t
+ring_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct ring *ring = arg->data;
+	size_t pos;
+
+	n = ring_take_many(ring, &pos, n);
+	phase_mark(PHASE_ACQUIRE);
+
+	for (size_t j = 0; j < n; j++) {
+		struct ring_ptr_slot *slot = (struct ring_ptr_slot *)ring_slot(ring, pos + j);
+		batch[j] = slot->data;
+		stall_point();
+		ring_release(ring, &slot->slot, pos + j);
+	}
+	phase_mark(PHASE_CRITICAL);
+
+	return (n);
+}
+
+static struct data *
+alloc_data_inline(void) {
+	struct data *data = &ring_in[ring_in_next++ % BATCH_MAX];
+	data->enqueued = 0;
+	return (data);
+}
+
+static void
+free_data_inline(struct data *data [[maybe_unused]]) {
+	/* The payload has been copied out of the slot */
+}
+
+static void
+ring_inline_put(struct ring_inline_slot *slot, const struct data *data) {
+	slot->value = data->value;
+	slot->enqueued = data->enqueued;
+	slot->producer = data->producer;
+}
+
+static struct data *
+ring_inline_get(const struct ring_inline_slot *slot) {
+	struct data *data = &ring_out[ring_out_next++ % BATCH_MAX];
+
+	data->value = slot->value;
+	data->enqueued = slot->enqueued;
+	data->producer = slot->producer;
+
+	return (data);
+}
+
+static void
+ring_inline_enqueue(struct thread_s *arg, struct data *newdata) {
+	struct ring *ring = arg->data;
+	size_t pos;
+
+	struct ring_inline_slot *slot = (struct ring_inline_slot *)ring_claim_wait(ring, &pos);
+	phase_mark(PHASE_ACQUIRE);
+
+	ring_inline_put(slot, newdata);
+	ring_publish(&slot->slot, pos);
+	phase_mark(PHASE_CRITICAL);
+}
+
+static struct data *
+ring_inline_dequeue(struct thread_s *arg) {
+	struct ring *ring = arg->data;
+	size_t pos;
+
+	struct ring_inline_slot *slot = (struct ring_inline_slot *)ring_take(ring, &pos);
+	phase_mark(PHASE_ACQUIRE);
+	if (slot == NULL) {
+		/* The same phases as a successful dequeue */
+		phase_mark(PHASE_CRITICAL);
+		return (NULL);
+	}
+
+	struct data *data = ring_inline_get(slot);
+	stall_point();
+	ring_release(ring, &slot->slot, pos);
+	phase_mark(PHASE_CRITICAL);
+
+	return (data);
+}
+
+static void
+ring_inline_enqueue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct ring *ring = arg->data;
+
+	for (size_t i = 0; i < n;) {
+		size_t pos;
+		size_t k = ring_claim_many_wait(ring, &pos, n - i);
+		phase_mark(PHASE_ACQUIRE);
+
+		for (size_t j = 0; j < k; j++) {
+			struct ring_inline_slot *slot = (struct ring_inline_slot *)ring_slot(ring, pos + j);
+			ring_inline_put(slot, batch[i + j]);
+			ring_publish(&slot->slot, pos + j);
+		}
+		phase_mark(PHASE_CRITICAL);
+		i += k;
+	}
+}
+
+static size_t
+ring_inline_dequeue_batch(struct thread_s *arg, struct data **batch, size_t n) {
+	struct ring *ring = arg->data;
+	size_t pos;
+
+	n = ring_take_many(ring, &pos, n);
+	phase_mark(PHASE_ACQUIRE);
+
+	for (size_t j = 0; j < n; j++) {
+		struct ring_inline_slot *slot = (struct ring_inline_slot *)ring_slot(ring, pos + j);
+		batch[j] = ring_inline_get(slot);
+		stall_point();
+		ring_release(ring, &slot->slot, pos + j);
+	}
+	phase_mark(PHASE_CRITICAL);
+
+	return (n);
+}
+
+static void
+smr_register(const struct test *test) {
+	switch (test->smr) {
+	case SMR_RCU:
+		rcu_register_thread();
+		rcu_offline();
+		break;
+	case SMR_EBR:
+		ebr_register_thread();
+		break;
+	case SMR_HP:
+		hp_register_thread();
+		break;
+	case SMR_NONE:
+		break;
+	}
+}
+
+static void
+smr_unregister(const struct test *test) {
+	switch (test->smr) {
+	case SMR_RCU:
+		rcu_unregister_thread();
+		break;
+	case SMR_EBR:
+		ebr_unregister_thread();
+		break;
+	case SMR_HP:
+		hp_unregister_thread();
+		break;
+	case SMR_NONE:
+		break;
+	}
+}
+
+static void
+smr_sampler_start(const struct test *test, uint64_t interval_ms, FILE *series) {
+	switch (test->smr) {
+	case SMR_RCU:
+		rcustat_sampler_start(test->name, interval_ms, series, synchronize_rcu);
+		break;
+	case SMR_EBR:
+		rcustat_sampler_start(test->name, interval_ms, series, ebr_synchronize);
+		break;
+	case SMR_HP:
+		/* There are no grace periods with hazard pointers */
+		rcustat_sampler_start(test->name, interval_ms, series, NULL);
+		break;
+	case SMR_NONE:
+		break;
+	}
+}
+
+static void
+batch_enqueue(struct thread_s *arg, uint64_t op) {
+	const struct test *test = arg->test;
+	struct data *batch[BATCH_MAX];
+
+	for (size_t i = 0; i < batch_size; i++) {
+		struct data *newdata = test->alloc();
+		newdata->value = op * batch_size + i;
+		if (sojourn_enabled) {
+			newdata->producer = arg - threads;
+			newdata->enqueued = phase_now();
+		}
+		batch[i] = newdata;
+	}
+	phase_mark(PHASE_ALLOCATE);
+
+	if (test->enqueue_batch != NULL) {
+		test->enqueue_batch(arg, batch, batch_size);
+	} else {
+		for (size_t i = 0; i < batch_size; i++) {
+			test->enqueue(arg, batch[i]);
+		}
+	}
+	arg->elements += batch_size;
+}
+
+static void
+batch_dequeue(struct thread_s *arg) {
+	const struct test *test = arg->test;
+	struct data *batch[BATCH_MAX];
+	size_t n = 0;
+
+	if (test->dequeue_batch != NULL) {
+		n = test->dequeue_batch(arg, batch, batch_size);
+	} else {
+		while (n < batch_size && (batch[n] = test->dequeue(arg)) != NULL) {
+			n++;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (sojourn_enabled && batch[i]->enqueued != 0) {
+			sojourn_record(&arg->sojourn, batch[i]->producer, batch[i]->value, batch[i]->enqueued);
+		}
+		test->reclaim(batch[i]);
+	}
+	if (n > 0) {
+		phase_mark(PHASE_RECLAIM);
+	}
+	arg->elements += n;
+}
+
+static void
+queue_run(void *arg0) {
+	struct thread_s *arg = arg0;
+	const struct test *test = arg->test;
+	struct timespec start, end;
+
+	smr_register(test);
+	perf_open(&arg->perf);
+	(void)uv_barrier_wait(arg->barrier);
+	if (test->smr == SMR_RCU) {
+		rcu_online();
+	}
+
+	perf_start(&arg->perf);
+	time_now(&start);
+
+	for (size_t i = 0; i < arg->ops; i++) {
+		bool write = (arg->role == ROLE_MIXED) ? rnd[i] : (arg->role == ROLE_PRODUCER);
+
+		if (stall_ms != 0 && arg == &threads[0] && i == arg->ops / 2) {
+			stall_pending = true;
+		}
+
+		uint64_t begin = fairness_begin();
+		phase_begin(&arg->phases, i);
+		if (batch_size != 0) {
+			if (write) {
+				arg->writes++;
+				batch_enqueue(arg, i);
+			} else {
+				arg->reads++;
+				batch_dequeue(arg);
+			}
+		} else if (write) {
+			arg->writes++;
+			struct data *newdata = test->alloc();
+			newdata->value = i;
+			if (sojourn_enabled) {
+				newdata->producer = arg - threads;
+				newdata->enqueued = phase_now();
+			}
+			phase_mark(PHASE_ALLOCATE);
+
+			if (bounded_enabled) {
+				bounded_enqueue(arg, newdata);
+			} else {
+				test->enqueue(arg, newdata);
+			}
+		} else {
+			arg->reads++;
+			struct data *data = bounded_enabled ? bounded_dequeue(arg) : test->dequeue(arg);
+
+			/* Do something with **data** */
+			if (data != NULL) {
+				if (sojourn_enabled && data->enqueued != 0) {
+					sojourn_record(&arg->sojourn, data->producer, data->value, data->enqueued);
+				}
+				test->reclaim(data);
+				phase_mark(PHASE_RECLAIM);
+			}
+		}
+		phase_end();
+		fairness_end(&arg->fairness, begin, write);
+
+		if (test->smr == SMR_RCU) {
+			rcu_quiescent(i);
+		}
+	}
+
+	time_now(&end);
+	perf_stop(&arg->perf);
+
+	if (bounded_enabled) {
+		/* Don't let the others wait for this thread */
+		atomic_fetch_add_relaxed(&bounded_idle, 1);
+		bounded_wake();
+	}
+
+	arg->diff = time_microdiff(&end, &start);
+	perf_close(&arg->perf);
+
+	smr_unregister(test);
+}
+
+/*
+ * RCU stress mode: every thread enqueues and dequeues one node at a fixed
+ * rate for a fixed time, so the dequeue rate (and thus the call_rcu() or
+ * ebr_retire() rate) is controlled independently of the backend speed.
+ */
+static uint64_t stress_duration;
+
+static void
+stress_run(void *arg0) {
+	struct thread_s *arg = arg0;
+	const struct test *test = arg->test;
+
+	smr_register(test);
+	(void)uv_barrier_wait(arg->barrier);
+	if (test->smr == SMR_RCU) {
+		rcu_online();
+	}
+
+	uint64_t start = uv_hrtime();
+	uint64_t deadline = start + stress_duration;
+	uint64_t interval = NS_PER_SEC / arg->rate;
+	uint64_t next = start;
+
+	/* Only the completed ops count towards the quiescent state period */
+	for (uint64_t op = 0;; op++) {
+		uint64_t now = uv_hrtime();
+		if (now < next && now < deadline) {
+			/* Don't hold back the grace periods while pacing */
+			if (test->smr == SMR_RCU) {
+				rcu_offline();
+			}
+			do {
+				pause();
+				now = uv_hrtime();
+			} while (now < next && now < deadline);
+			if (test->smr == SMR_RCU) {
+				rcu_online();
+			}
+		}
+		if (now >= deadline) {
+			break;
+		}
+		next += interval;
+
+		arg->writes++;
+		struct data *newdata = test->alloc();
+		newdata->value = op;
+		test->enqueue(arg, newdata);
+
+		struct data *data = test->dequeue(arg);
+		if (data != NULL) {
+			arg->reads++;
+			test->reclaim(data);
+		}
+
+		if (test->smr == SMR_RCU) {
+			rcu_quiescent(op);
+		}
+	}
+
+	arg->diff = (uv_hrtime() - start) / NS_PER_US;
+
+	smr_unregister(test);
+}
+
+/*
+ * Double the dequeue rate until the deferred free backlog stops being
+ * bounded: a bounded backlog levels off at rate * (grace period + callback latency),
+ * an unbounded one keeps growing, so it is sampled in the middle and at the
+ * end of every step.
+ */
+static void
+rcu_stress(const struct test *test, struct thread_s *threads, uint8_t num_threads, uint64_t step_ms) {
+	uint64_t bounded = 0;
+
+	stress_duration = step_ms * NS_PER_MS;
+
+	for (uint64_t rate = 1024; rate < (UINT64_C(1) << 32); rate *= 2) {
+		uv_barrier_t barrier;
+		uv_mutex_t mutex;
+
+		int r = uv_barrier_init(&barrier, num_threads);
+		assert(r == 0);
+		r = uv_mutex_init(&mutex);
+		assert(r == 0);
+
+		void *data = test->new(1024 * num_threads);
+
+		smr_sampler_start(test, step_ms / 10 + 1, NULL);
+
+		for (size_t i = 0; i < num_threads; i++) {
+			struct thread_s *t = &threads[i];
+			*t = (struct thread_s){
+				.barrier = &barrier,
+				.mutex = &mutex,
+				.rate = (rate + num_threads - 1) / num_threads,
+				.data = data,
+				.test = test,
+			};
+
+			r = uv_thread_create(&t->thread, stress_run, t);
+			assert(r == 0);
+		}
+
+		uv_sleep(step_ms / 2);
+		uint64_t half = rcustat_outstanding();
+
+		uint64_t reads = 0;
+		for (size_t i = 0; i < num_threads; i++) {
+			r = uv_thread_join(&threads[i].thread);
+			assert(r == 0);
+			reads += threads[i].reads;
+		}
+		uint64_t end = rcustat_outstanding();
+
+		struct rcustat_summary summary;
+		rcustat_sampler_stop(&summary);
+
+		double achieved = (double)reads * MS_PER_SEC / step_ms;
+		bool growing = (end > half + half / 2 && end > 1024);
+
+		printf("%10s | %10" PRIu64 " | %10.0f | %10" PRIu64 " | %10" PRIu64 " | %8.1fus | %s\n", test->name,
+		       rate, achieved, half, end,
+		       (summary.gp_count > 0) ? (double)summary.gp_total_ns / summary.gp_count / 1000 : 0.0,
+		       growing ? "unbounded" : "bounded");
+
+		test->destroy(data);
+		rcu_barrier();
+		ebr_barrier();
+		hp_barrier();
+
+		uv_mutex_destroy(&mutex);
+		uv_barrier_destroy(&barrier);
+
+		if (growing) {
+			printf("%10s: deferred free backlog unbounded at %" PRIu64 " dequeues/s, bounded up to %" PRIu64
+			       " dequeues/s\n",
+			       test->name, rate, bounded);
+			return;
+		}
+		if (achieved < 0.9 * rate) {
+			printf("%10s: deferred free backlog bounded up to the maximum of %.0f dequeues/s\n", test->name,
+			       achieved);
+			return;
+		}
+
+		bounded = rate;
+	}
+}
+
+enum {
+	OPT_HITM_EVENT = 256,
+	OPT_RCU_STRESS,
+	OPT_STALL,
+	OPT_HUGE_PAGES,
+	OPT_PREFAULT,
+	OPT_MLOCK,
+	OPT_BULK_PREFILL,
+	OPT_OCCUPANCY,
+	OPT_CAPACITY,
+	OPT_WAIT,
+	OPT_SOJOURN,
+	OPT_ROLES,
+	OPT_BATCH,
+	OPT_LIFO,
+};
+
+static struct option long_options[] = {
+	{ "allocator", required_argument, NULL, 'a' },
+	{ "perf", no_argument, NULL, 'p' },
+	{ "hitm-event", required_argument, NULL, OPT_HITM_EVENT },
+	{ "sample", required_argument, NULL, 's' },
+	{ "fairness", optional_argument, NULL, 'f' },
+	{ "memory", optional_argument, NULL, 'm' },
+	{ "qsbr-period", required_argument, NULL, 'q' },
+	{ "rcu-stats", optional_argument, NULL, 'r' },
+	{ "rcu-stress", optional_argument, NULL, OPT_RCU_STRESS },
+	{ "stall", optional_argument, NULL, OPT_STALL },
+	{ "huge-pages", optional_argument, NULL, OPT_HUGE_PAGES },
+	{ "prefault", optional_argument, NULL, OPT_PREFAULT },
+	{ "mlock", no_argument, NULL, OPT_MLOCK },
+	{ "bulk-prefill", no_argument, NULL, OPT_BULK_PREFILL },
+	{ "occupancy", required_argument, NULL, OPT_OCCUPANCY },
+	{ "capacity", required_argument, NULL, OPT_CAPACITY },
+	{ "wait", required_argument, NULL, OPT_WAIT },
+	{ "sojourn", no_argument, NULL, OPT_SOJOURN },
+	{ "roles", required_argument, NULL, OPT_ROLES },
+	{ "batch", required_argument, NULL, OPT_BATCH },
+	{ "lifo", no_argument, NULL, OPT_LIFO },
+	{ NULL, 0, NULL, 0 },
+};
+
+void
+usage(int argc [[maybe_unused]], char **argv) {
+	fprintf(stderr,
+		"usage: %s [options] <num_threads> <num_ops> <read_write_ratio> [<r|w|n>]\n"
+		"\n"
+		"  -a, --allocator=<name>  allocate the nodes with jemalloc (default), je-arena,\n"
+		"                           je-notcache, malloc, pool, mctx or all of them in turn\n"
+		"  -p, --perf               report per-op hardware/software performance counters\n"
+		"      --hitm-event=<code>  raw PMU event counting HITM loads (e.g. 0x04d2 on Skylake)\n"
+		"  -s, --sample=<n>         break every n-th op down into phases (ns per sampled op)\n"
+		"  -f, --fairness[=<us>]    report per-thread fairness, flag ops blocked longer than <us>\n"
+		"  -m, --memory[=<ms>]      sample RSS and jemalloc stats every <ms> during the run\n"
+		"  -q, --qsbr-period=<k>    announce a QSBR quiescent state every <k> ops (urcu flavor: " RCU_FLAVOR ")\n"
+		"  -r, --rcu-stats[=<ms>]   sample call_rcu()/EBR backlog and grace periods, series on stderr\n"
+		"      --rcu-stress[=<ms>]  find the dequeue rate where the call_rcu()/EBR backlog grows unbounded\n"
+		"      --stall[=<ms>]       stall the first thread mid-dequeue, report the memory held\n"
+		"      --huge-pages[=<m>]   back the op arrays and pool slabs with <m>=thp (default) or hugetlb\n"
+		"      --prefault[=<MiB>]   pre-fault the op arrays and <MiB> of pool slabs before the run\n"
+		"      --mlock              lock the op arrays and pool slabs in memory\n"
+		"      --bulk-prefill       prefill the lists and lfqueue from per-CPU arenas in parallel\n"
+		"      --occupancy=<n>      prefill only <n> nodes and keep polling when the queue is empty\n"
+		"      --capacity=<n>       make the enqueues wait while the queue holds <n> nodes\n"
+		"      --wait=<spin|park>   spin (default) or park on an empty or full queue\n"
+		"      --sojourn            report the enqueue-to-dequeue latency and FIFO reorderings\n"
+		"      --roles=<P>:<C>      run P producers and C consumers instead of <num_threads> mixed threads\n"
+		"      --batch=<n>          move <n> (1-256) elements per op with the batch operations\n"
+		"      --lifo               run only the stacks (mutexstack, wfstack, lfstack and elimstack)\n",
+		argv[0]);
+}
+
+/*
+ * Bulk prefill: instead of allocating and enqueueing the prefilled nodes
+ * one by one on the main thread, every CPU allocates a contiguous chunk of
+ * nodes and links it into a chain, and the main thread only stitches the
+ * chains together.  The arena nodes are flagged, so freeing them during
+ * the run is a no-op, and the teardown unmaps the chunks in parallel.
+ */
+enum prefill_kind {
+	PREFILL_LIST,
+	PREFILL_LFQUEUE,
+};
+
+struct prefill_chunk {
+	uv_thread_t thread;
+	enum prefill_kind kind;
+	struct data *nodes;
+	size_t first;
+	size_t nelements;
+};
+
+static bool bulk_prefill;
+static struct prefill_chunk *prefill_chunks;
+static size_t prefill_nchunks;
+
+static void
+prefill_run(void *arg) {
+	struct prefill_chunk *chunk = arg;
+	struct data *nodes = hugemem_alloc(chunk->nelements * sizeof(nodes[0]));
+	size_t last = chunk->nelements - 1;
+
+	for (size_t i = 0; i < chunk->nelements; i++) {
+		struct data *data = &nodes[i];
+
+		data->value = chunk->first + i;
+		data->arena = true;
+
+		switch (chunk->kind) {
+		case PREFILL_LIST:
+			data->head.prev = (i > 0) ? &nodes[i - 1].head : NULL;
+			data->head.next = (i < last) ? &nodes[i + 1].head : NULL;
+			break;
+		case PREFILL_LFQUEUE:
+			cds_lfq_node_init_rcu(&data->node);
+			data->node.next = (i < last) ? &nodes[i + 1].node : NULL;
+			break;
+		}
+	}
+
+	chunk->nodes = nodes;
+}
+
+static void
+prefill_free_run(void *arg) {
+	struct prefill_chunk *chunk = arg;
+
+	hugemem_free(chunk->nodes, chunk->nelements * sizeof(chunk->nodes[0]));
+}
+
+static void
+prefill_spawn(uv_thread_cb cb) {
+	for (size_t i = 0; i < prefill_nchunks; i++) {
+		int r = uv_thread_create(&prefill_chunks[i].thread, cb, &prefill_chunks[i]);
+		assert(r == 0);
+	}
+	for (size_t i = 0; i < prefill_nchunks; i++) {
+		int r = uv_thread_join(&prefill_chunks[i].thread);
+		assert(r == 0);
+	}
+}
+
+/*
+ * Allocate and link the chunks, and return the first and the last node of
+ * the whole chain.
+ */
+static void
+prefill_new(size_t nelements, enum prefill_kind kind, struct data **firstp, struct data **lastp) {
+	size_t nchunks = uv_available_parallelism();
+	if (nchunks > nelements) {
+		nchunks = nelements;
+	}
+
+	prefill_chunks = calloc(nchunks, sizeof(prefill_chunks[0]));
+	prefill_nchunks = nchunks;
+
+	for (size_t i = 0, first = 0; i < nchunks; i++) {
+		size_t n = nelements / nchunks + (i < nelements % nchunks);
+		prefill_chunks[i] = (struct prefill_chunk){
+			.kind = kind,
+			.first = first,
+			.nelements = n,
+		};
+		first += n;
+	}
+
+	prefill_spawn(prefill_run);
+
+	struct data *first = NULL, *last = NULL;
+	for (size_t i = 0; i < nchunks; i++) {
+		struct prefill_chunk *chunk = &prefill_chunks[i];
+		struct data *head = &chunk->nodes[0];
+
+		if (last == NULL) {
+			first = head;
+		} else if (kind == PREFILL_LIST) {
+			last->head.next = &head->head;
+			head->head.prev = &last->head;
+		} else {
+			last->node.next = &head->node;
+		}
+
+		last = &chunk->nodes[chunk->nelements - 1];
+	}
+
+	*firstp = first;
+	*lastp = last;
+}
+
+static void
+prefill_destroy(void) {
+	if (prefill_chunks == NULL) {
+		return;
+	}
+
+	/* The deferred frees still look at the arena nodes */
+	rcu_barrier();
+	ebr_barrier();
+
+	prefill_spawn(prefill_free_run);
+
+	free(prefill_chunks);
+	prefill_chunks = NULL;
+	prefill_nchunks = 0;
+}
+
+static void *
+list_new(size_t nelements) {
+	struct cds_list_head *head = malloc(sizeof(*head));
+	CDS_INIT_LIST_HEAD(head);
+
+	if (bulk_prefill && nelements > 0) {
+		struct data *first, *last;
+		prefill_new(nelements, PREFILL_LIST, &first, &last);
+
+		head->next = &first->head;
+		first->head.prev = head;
+		last->head.next = head;
+		head->prev = &last->head;
+
+		return head;
+	}
+
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *newdata = alloc_data();
+		cds_list_add_tail(&newdata->head, head);
+	}
+
+	return head;
+}
+
+static void
+list_destroy(void *arg) {
+	struct cds_list_head *head = arg;
+	struct cds_list_head *pos, *p;
+
+	cds_list_for_each_safe(pos, p, head) {
+		struct data *data = caa_container_of(pos, struct data, head);
+		release_data(data);
+	}
+
+	prefill_destroy();
+}
+
+static void *
+tslist_new(size_t nelements) {
+	struct cds_list_head *head = malloc(sizeof(*head));
+	CDS_INIT_LIST_HEAD(head);
+
+	data_cache = tscache_new(sizeof(struct data));
+
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *newdata = alloc_data_ts();
+		cds_list_add_tail(&newdata->head, head);
+	}
+
+	return head;
+}
+
+static void
+tslist_destroy(void *arg) {
+	/* The slabs go away with all the nodes still on the list */
+	tscache_destroy(data_cache);
+	free(arg);
+}
+
+static void *
+lfqueue_new(size_t nelements) {
+	struct cds_lfq_queue_rcu *queue = malloc(sizeof(*queue));
+
+	cds_lfq_init_rcu(queue, call_rcu);
+
+	if (bulk_prefill && nelements > 0) {
+		struct data *first, *last;
+		prefill_new(nelements, PREFILL_LFQUEUE, &first, &last);
+
+		/*
+		 * The whole chain goes in with a single enqueue, which leaves
+		 * the tail at the first node.  The setup is single-threaded,
+		 * so the tail is then moved to the last node directly.
+		 */
+		rcu_read_lock();
+		cds_lfq_enqueue_rcu(queue, &first->node);
+		queue->tail = &last->node;
+		rcu_read_unlock();
+
+		return queue;
+	}
+
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *data = alloc_data();
+		data->value = i;
+		rcu_read_lock();
+		cds_lfq_node_init_rcu(&data->node);
+		cds_lfq_enqueue_rcu(queue, &data->node);
+		rcu_read_unlock();
+	}
+
+	return queue;
+}
+
+static void
+lfqueue_destroy(void *arg) {
+	struct cds_lfq_queue_rcu *queue = arg;
+	struct cds_lfq_node_rcu *node = NULL;
+
+	while ((node = cds_lfq_dequeue_rcu(queue)) != NULL) {
+		struct data *data = caa_container_of(node, struct data, node);
+
+		release_data(data);
+	}
+
+	cds_lfq_destroy_rcu(queue);
+
+	prefill_destroy();
+}
+
+static void *
+wfcq_new(size_t nelements) {
+	struct wfcq *queue = aligned_alloc(alignof(struct wfcq), sizeof(*queue));
+
+	cds_wfcq_init(&queue->head, &queue->tail);
+
+	queue->batches = aligned_alloc(alignof(struct wfcq_batch), bench_nthreads * sizeof(queue->batches[0]));
+	for (size_t i = 0; i < bench_nthreads; i++) {
+		__cds_wfcq_init(&queue->batches[i].head, &queue->batches[i].tail);
+	}
+
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *data = alloc_data();
+		data->value = i;
+		cds_wfcq_node_init(&data->wfcq_node);
+		(void)cds_wfcq_enqueue(&queue->head, &queue->tail, &data->wfcq_node);
+	}
+
+	return queue;
+}
+
+static void
+wfcq_destroy(void *arg) {
+	struct wfcq *queue = arg;
+	struct cds_wfcq_node *node = NULL;
+
+	/* The nodes left over in the private batches go first */
+	for (size_t i = 0; i < bench_nthreads; i++) {
+		struct wfcq_batch *batch = &queue->batches[i];
+		while ((node = __cds_wfcq_dequeue_blocking(&batch->head, &batch->tail)) != NULL) {
+			release_data(caa_container_of(node, struct data, wfcq_node));
+		}
+	}
+
+	while ((node = __cds_wfcq_dequeue_blocking(&queue->head, &queue->tail)) != NULL) {
+		release_data(caa_container_of(node, struct data, wfcq_node));
+	}
+
+	cds_wfcq_destroy(&queue->head, &queue->tail);
+	free(queue->batches);
+	free(queue);
+}
+
+static void *
+wfstack_new(size_t nelements) {
+	struct cds_wfs_stack *stack = malloc(sizeof(*stack));
+
+	cds_wfs_init(stack);
+
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *data = alloc_data();
+		data->value = i;
+		cds_wfs_node_init(&data->wfs_node);
+		(void)cds_wfs_push(stack, &data->wfs_node);
+	}
+
+	return stack;
+}
+
+static void
+wfstack_destroy(void *arg) {
+	struct cds_wfs_stack *stack = arg;
+	struct cds_wfs_node *node = NULL;
+
+	while ((node = __cds_wfs_pop_blocking(stack)) != NULL) {
+		release_data(caa_container_of(node, struct data, wfs_node));
+	}
+
+	cds_wfs_destroy(stack);
+	free(stack);
+}
+
+static void *
+lfstack_new(size_t nelements) {
+	struct cds_lfs_stack *stack = malloc(sizeof(*stack));
+
+	cds_lfs_init(stack);
+
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *data = alloc_data();
+		data->value = i;
+		cds_lfs_node_init(&data->lfs_node);
+		(void)cds_lfs_push(stack, &data->lfs_node);
+	}
+
+	return stack;
+}
 
-	time_now(&start);
+static void
+lfstack_destroy(void *arg) {
+	struct cds_lfs_stack *stack = arg;
+	struct cds_lfs_node *node = NULL;
 
-	for (size_t i = 0; i < arg->ops; i++) {
-		if (rnd[i]) {
-			arg->writes++;
-			struct data *newdata = malloc(sizeof(*newdata));
-			pthread_rwlock_wrlock(arg->rwlock);
-			newdata->value = i;
-			cds_list_add_tail(&newdata->head, head);
-			pthread_rwlock_unlock(arg->rwlock);
-		} else {
-			arg->reads++;
-			struct data *data;
+	while ((node = __cds_lfs_pop(stack)) != NULL) {
+		release_data(caa_container_of(node, struct data, lfs_node));
+	}
 
-			pthread_rwlock_rdlock(arg->rwlock);
-			data = cds_list_first_entry(head, struct data, head);
-			pthread_rwlock_unlock(arg->rwlock);
-			if (data == NULL) {
-				continue;
-			}
+	cds_lfs_destroy(stack);
+	free(stack);
+}
 
-			pthread_rwlock_wrlock(arg->rwlock);
-			data = cds_list_first_entry(head, struct data, head);
-			cds_list_del_rcu(&data->head);
-			pthread_rwlock_unlock(arg->rwlock);
+static void *
+elimstack_bench_new(size_t nelements) {
+	struct elimstack *stack = elimstack_new();
 
-			/* Do something with **data** */
-			if (data != NULL) {
-				free(data);
-			}
-		}
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *data = alloc_data();
+		data->value = i;
+		elimstack_push(stack, &data->elim_node);
 	}
 
-	time_now(&end);
-
-	arg->diff = time_microdiff(&end, &start);
+	return (stack);
 }
 
 static void
-crwwp_queue_run(void *arg0) {
-	struct thread_s *arg = arg0;
-	struct timespec start, end;
-	struct cds_list_head *head = arg->data;
+elimstack_bench_destroy(void *arg) {
+	struct elimstack *stack = arg;
+	struct elimstack_node *node = NULL;
 
-	(void)uv_barrier_wait(arg->barrier);
+	while ((node = elimstack_pop(stack)) != NULL) {
+		release_data(caa_container_of(node, struct data, elim_node));
+	}
 
-	time_now(&start);
+	elimstack_destroy(stack);
+}
 
-	for (size_t i = 0; i < arg->ops; i++) {
-		if (rnd[i]) {
-			arg->writes++;
-			struct data *newdata = malloc(sizeof(*newdata));
-			rwlock_wrlock(arg->crwwp);
-			newdata->value = i;
-			cds_list_add_tail(&newdata->head, head);
-			rwlock_wrunlock(arg->crwwp);
-		} else {
-			arg->reads++;
-			struct data *data;
+static void *
+msqueue_new(size_t nelements) {
+	struct msqueue *queue = aligned_alloc(alignof(struct msqueue), sizeof(*queue));
+	struct msqueue_node *dummy = msqueue_node_new(NULL);
 
-			rwlock_rdlock(arg->crwwp);
-			data = cds_list_first_entry(head, struct data, head);
-			if (data == NULL) {
-				rwlock_rdunlock(arg->crwwp);
-				continue;
-			}
+	atomic_init(&queue->head, dummy);
+	atomic_init(&queue->tail, dummy);
 
-			int r = rwlock_tryupgrade(arg->crwwp);
-			if (r != 0) {
-				assert(r == EBUSY);
-				rwlock_rdunlock(arg->crwwp);
-				rwlock_wrlock(arg->crwwp);
-				data = cds_list_first_entry(head, struct data, head);
-			}
+	hp_register_thread();
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *data = alloc_data();
+		data->value = i;
+		struct msqueue_node *node = msqueue_node_new(data);
+		msqueue_push(queue, node, node);
+	}
+	hp_unregister_thread();
 
-			if (data != NULL) {
-				cds_list_del_rcu(&data->head);
-			}
-			rwlock_wrunlock(arg->crwwp);
+	return queue;
+}
 
-			/* Do something with **data** */
-			if (data != NULL) {
-				free(data);
-			}
+static void
+msqueue_destroy(void *arg) {
+	struct msqueue *queue = arg;
+	struct msqueue_node *node = atomic_load_relaxed(&queue->head);
+
+	/* The first node is the dummy, its data has been dequeued already */
+	while (node != NULL) {
+		struct msqueue_node *next = atomic_load_relaxed(&node->next);
+		if (next != NULL) {
+			release_data(next->data);
 		}
+		node_free(node, sizeof(*node));
+		node = next;
 	}
 
-	time_now(&end);
-
-	arg->diff = time_microdiff(&end, &start);
+	free(queue);
 }
 
-static void
-free_data_rcu(struct rcu_head *rcu_head) {
-	struct data *data = caa_container_of(rcu_head, struct data, rcu_head);
-	free(data);
-}
+#if HAVE_LCRQ
+static void *
+lcrq_bench_new(size_t nelements) {
+	struct lcrq *lcrq = lcrq_new();
 
-static void
-rcu_queue_run(void *arg0) {
-	struct thread_s *arg = arg0;
-	struct timespec start, end;
-	struct cds_list_head *head = arg->data;
+	rcu_read_lock();
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *data = alloc_data();
+		data->value = i;
+		lcrq_enqueue(lcrq, data);
+	}
+	rcu_read_unlock();
 
-	rcu_register_thread();
-	(void)uv_barrier_wait(arg->barrier);
+	return (lcrq);
+}
 
-	time_now(&start);
+static void
+lcrq_bench_destroy(void *arg) {
+	struct lcrq *lcrq = arg;
+	struct data *data;
 
-	for (size_t i = 0; i < arg->ops; i++) {
-		if (rnd[i]) {
-			arg->writes++;
-			struct data *newdata = malloc(sizeof(*newdata));
-			uv_mutex_lock(arg->mutex);
-			newdata->value = i;
-			cds_list_add_tail_rcu(&newdata->head, head);
-			uv_mutex_unlock(arg->mutex);
-		} else {
-			arg->reads++;
-			struct data *data;
+	rcu_read_lock();
+	while ((data = lcrq_dequeue(lcrq)) != NULL) {
+		release_data(data);
+	}
+	rcu_read_unlock();
 
-			rcu_read_lock();
-			data = cds_list_first_entry(head, struct data, head);
-			rcu_read_unlock();
-			if (data == NULL) {
-				continue;
-			}
+	lcrq_destroy(lcrq);
+}
+#endif /* HAVE_LCRQ */
 
-			uv_mutex_lock(arg->mutex);
-			data = cds_list_first_entry(head, struct data, head);
-			cds_list_del(&data->head);
-			uv_mutex_unlock(arg->mutex);
+static void *
+lscq_bench_new(size_t nelements) {
+	struct lscq *lscq = lscq_new();
 
-			if (data != NULL) {
-				/* Do something with **data** */
-				call_rcu(&data->rcu_head, free_data_rcu);
-			}
-		}
+	rcu_read_lock();
+	for (size_t i = 0; i < nelements; i++) {
+		struct data *data = alloc_data();
+		data->value = i;
+		lscq_enqueue(lscq, data);
 	}
+	rcu_read_unlock();
 
-	time_now(&end);
+	return (lscq);
+}
 
-	arg->diff = time_microdiff(&end, &start);
+static void
+lscq_bench_destroy(void *arg) {
+	struct lscq *lscq = arg;
+	struct data *data;
 
-	rcu_unregister_thread();
+	rcu_read_lock();
+	while ((data = lscq_dequeue(lscq)) != NULL) {
+		release_data(data);
+	}
+	rcu_read_unlock();
+
+	lscq_destroy(lscq);
 }
 
-static void
-lfqueue_run(void *arg0) {
-	struct thread_s *arg = arg0;
-	struct timespec start, end;
-	struct cds_lfq_queue_rcu *queue = arg->data;
+static void *
+sharded_new(size_t nelements) {
+	struct sharded *sharded = malloc(sizeof(*sharded));
 
-	rcu_register_thread();
-	(void)uv_barrier_wait(arg->barrier);
+	*sharded = (struct sharded){
+		.shards = aligned_alloc(alignof(struct shard), bench_nthreads * sizeof(sharded->shards[0])),
+		.nshards = bench_nthreads,
+	};
 
-	time_now(&start);
+	for (size_t i = 0; i < sharded->nshards; i++) {
+		struct shard *shard = &sharded->shards[i];
+		int r = uv_mutex_init(&shard->lock);
+		assert(r == 0);
+		CDS_INIT_LIST_HEAD(&shard->head);
+		atomic_init(&shard->count, 0);
+	}
 
-	for (size_t i = 0; i < arg->ops; i++) {
-		if (rnd[i]) {
-			arg->writes++;
-			struct data *newdata = malloc(sizeof(*newdata));
-			newdata->value = i;
-			cds_lfq_node_init_rcu(&newdata->node);
+	/* The prefilled nodes are dealt out to all the shards */
+	for (size_t i = 0; i < nelements; i++) {
+		struct shard *shard = &sharded->shards[i % sharded->nshards];
+		struct data *data = alloc_data();
+		data->value = i;
+		cds_list_add_tail(&data->head, &shard->head);
+		atomic_store_relaxed(&shard->count, atomic_load_relaxed(&shard->count) + 1);
+	}
 
-			rcu_read_lock();
-			cds_lfq_enqueue_rcu(queue, &newdata->node);
-			rcu_read_unlock();
-		} else {
-			arg->reads++;
-			struct cds_lfq_node_rcu *node = NULL;
-			struct data *data = NULL;
+	return (sharded);
+}
 
-			rcu_read_lock();
-			node = cds_lfq_dequeue_rcu(queue);
-			rcu_read_unlock();
-			if (node == NULL) {
-				continue;
-			}
+static void
+sharded_destroy(void *arg) {
+	struct sharded *sharded = arg;
 
-			data = (node != NULL) ? caa_container_of(node, struct data, node) : NULL;
+	for (size_t i = 0; i < sharded->nshards; i++) {
+		struct shard *shard = &sharded->shards[i];
+		struct data *data;
 
-			/* Do something with **data** */
-			if (data != NULL) {
-				call_rcu(&data->rcu_head, free_data_rcu);
-			}
+		while ((data = list_first(&shard->head)) != NULL) {
+			cds_list_del(&data->head);
+			release_data(data);
 		}
+		uv_mutex_destroy(&shard->lock);
 	}
 
-	time_now(&end);
+	free(sharded->shards);
+	free(sharded);
+}
 
-	arg->diff = time_microdiff(&end, &start);
+static struct ring *
+ring_create(size_t nelements, size_t slot_size) {
+	struct ring *ring = aligned_alloc(alignof(struct ring), sizeof(*ring));
+	size_t nslots = 2;
 
-	rcu_unregister_thread();
-}
+	while (nslots < nelements + ring_headroom) {
+		nslots <<= 1;
+	}
 
-struct thread_s *threads;
+	*ring = (struct ring){
+		.mask = nslots - 1,
+		.slot_size = slot_size,
+		.slots = hugemem_alloc(nslots * slot_size),
+	};
 
-void
-usage(int argc [[maybe_unused]], char **argv) {
-	fprintf(stderr, "usage: %s <num_threads> <num_ops> <read_write_ratio> [<r|w|n>]\n", argv[0]);
+	for (size_t i = 0; i < nslots; i++) {
+		atomic_init(&ring_slot(ring, i)->seq, i);
+	}
+
+	return (ring);
 }
 
-struct test {
-	const char *name;
-	void *(*new)(size_t nelements);
-	uv_thread_cb run;
-	void (*destroy)(void *);
-};
+static void
+ring_free(struct ring *ring) {
+	hugemem_free(ring->slots, (ring->mask + 1) * ring->slot_size);
+	free(ring);
+}
 
 static void *
-list_new(size_t nelements) {
-	struct cds_list_head *head = malloc(sizeof(*head));
-	CDS_INIT_LIST_HEAD(head);
+ring_new(size_t nelements) {
+	struct ring *ring = ring_create(nelements, sizeof(struct ring_ptr_slot));
 
 	for (size_t i = 0; i < nelements; i++) {
-		struct data *newdata = malloc(sizeof(*newdata));
-		cds_list_add_tail(&newdata->head, head);
+		size_t pos;
+		struct ring_ptr_slot *slot = (struct ring_ptr_slot *)ring_claim(ring, &pos);
+		slot->data = alloc_data();
+		slot->data->value = i;
+		ring_publish(&slot->slot, pos);
 	}
 
-	return head;
+	return (ring);
 }
 
 static void
-list_destroy(void *arg) {
-	struct cds_list_head *head = arg;
-	struct cds_list_head *pos, *p;
-
-	cds_list_for_each_safe(pos, p, head) {
-		struct data *data = caa_container_of(pos, struct data, head);
-		free(data);
+ring_destroy(void *arg) {
+	struct ring *ring = arg;
+	struct ring_ptr_slot *slot;
+	size_t pos;
+
+	while ((slot = (struct ring_ptr_slot *)ring_take(ring, &pos)) != NULL) {
+		release_data(slot->data);
+		ring_release(ring, &slot->slot, pos);
 	}
+
+	ring_free(ring);
 }
 
 static void *
-lfqueue_new(size_t nelements) {
-	struct cds_lfq_queue_rcu *queue = malloc(sizeof(*queue));
-
-	cds_lfq_init_rcu(queue, call_rcu);
+ring_inline_new(size_t nelements) {
+	struct ring *ring = ring_create(nelements, sizeof(struct ring_inline_slot));
 
 	for (size_t i = 0; i < nelements; i++) {
-		struct data *data = malloc(sizeof(*data));
-		data->value = i;
-		rcu_read_lock();
-		cds_lfq_node_init_rcu(&data->node);
-		cds_lfq_enqueue_rcu(queue, &data->node);
-		rcu_read_unlock();
+		size_t pos;
+		struct ring_inline_slot *slot = (struct ring_inline_slot *)ring_claim(ring, &pos);
+		slot->value = i;
+		slot->enqueued = 0;
+		ring_publish(&slot->slot, pos);
 	}
 
-	return queue;
+	return (ring);
 }
 
 static void
-lfqueue_destroy(void *arg) {
-	struct cds_lfq_queue_rcu *queue = arg;
-	struct cds_lfq_node_rcu *node = NULL;
-
-	while ((node = cds_lfq_dequeue_rcu(queue)) != NULL) {
-		struct data *data = caa_container_of(node, struct data, node);
-
-		free(data);
-	}
-
-	cds_lfq_destroy_rcu(queue);
+ring_inline_destroy(void *arg) {
+	ring_free(arg);
 }
 
 static struct test test_list[] = {
-	{ "mutex", list_new, mutex_queue_run, list_destroy },
-	{ "rwlock", list_new, rwlock_queue_run, list_destroy },
-	{ "c-rw-wp", list_new, crwwp_queue_run, list_destroy },
-	{ "rculist", list_new, rcu_queue_run, list_destroy },
-	{ "lfqueue", lfqueue_new, lfqueue_run, lfqueue_destroy },
-	{ NULL, NULL, NULL, NULL },
+	{ "mutex", list_new, alloc_data, mutex_enqueue, mutex_dequeue, free_data, list_destroy, SMR_NONE,
+	  mutex_enqueue_batch, mutex_dequeue_batch },
+	{ "rwlock", list_new, alloc_data, rwlock_enqueue, rwlock_dequeue, free_data, list_destroy, SMR_NONE,
+	  rwlock_enqueue_batch, rwlock_dequeue_batch },
+	{ "c-rw-wp", list_new, alloc_data, crwwp_enqueue, crwwp_dequeue, free_data, list_destroy, SMR_NONE,
+	  crwwp_enqueue_batch, crwwp_dequeue_batch },
+	{ "rculist", list_new, alloc_data, rcu_enqueue, rcu_dequeue, free_data_call_rcu, list_destroy, SMR_RCU,
+	  mutex_enqueue_batch, mutex_dequeue_batch },
+	{ "rculist-ts", tslist_new, alloc_data_ts, rcu_enqueue, rcu_ts_dequeue, free_data_ts, tslist_destroy, SMR_RCU,
+	  mutex_enqueue_batch, mutex_dequeue_batch },
+	{ "ebrlist", list_new, alloc_data, rcu_enqueue, ebr_dequeue, free_data_retire, list_destroy, SMR_EBR,
+	  mutex_enqueue_batch, mutex_dequeue_batch },
+	{ "lfqueue", lfqueue_new, alloc_data, lfqueue_enqueue, lfqueue_dequeue, free_data_call_rcu, lfqueue_destroy,
+	  SMR_RCU, lfqueue_enqueue_batch, lfqueue_dequeue_batch },
+	{ "wfcqueue", wfcq_new, alloc_data, wfcq_enqueue, wfcq_dequeue, free_data, wfcq_destroy, SMR_NONE,
+	  wfcq_enqueue_batch, wfcq_dequeue_batch },
+	{ "wfcq-batch", wfcq_new, alloc_data, wfcq_enqueue, wfcq_batch_dequeue, free_data, wfcq_destroy, SMR_NONE,
+	  wfcq_enqueue_batch, wfcq_batch_dequeue_batch },
+	{ "mutexstack", list_new, alloc_data, mutex_push, mutex_dequeue, free_data, list_destroy, SMR_NONE,
+	  mutex_push_batch, mutex_dequeue_batch, true },
+	{ "wfstack", wfstack_new, alloc_data, wfstack_enqueue, wfstack_dequeue, free_data, wfstack_destroy, SMR_NONE,
+	  NULL, wfstack_dequeue_batch, true },
+	{ "lfstack", lfstack_new, alloc_data, lfstack_enqueue, lfstack_dequeue, free_data_call_rcu, lfstack_destroy,
+	  SMR_RCU, NULL, lfstack_dequeue_batch, true },
+	{ "elimstack", elimstack_bench_new, alloc_data, elimstack_bench_enqueue, elimstack_bench_dequeue,
+	  free_data_call_rcu, elimstack_bench_destroy, SMR_RCU, NULL, NULL, true },
+	{ "msqueue", msqueue_new, alloc_data, msqueue_enqueue, msqueue_dequeue, free_data, msqueue_destroy, SMR_HP,
+	  msqueue_enqueue_batch, NULL },
+#if HAVE_LCRQ
+	{ "lcrq", lcrq_bench_new, alloc_data, lcrq_bench_enqueue, lcrq_bench_dequeue, free_data, lcrq_bench_destroy,
+	  SMR_RCU, NULL, NULL },
+#endif /* HAVE_LCRQ */
+	{ "lscq", lscq_bench_new, alloc_data, lscq_bench_enqueue, lscq_bench_dequeue, free_data, lscq_bench_destroy,
+	  SMR_RCU, NULL, NULL },
+	{ "sharded", sharded_new, alloc_data, sharded_enqueue, sharded_dequeue, free_data, sharded_destroy, SMR_NONE,
+	  sharded_enqueue_batch, sharded_dequeue_batch },
+	{ "ring", ring_new, alloc_data, ring_enqueue, ring_dequeue, free_data, ring_destroy, SMR_NONE, ring_enqueue_batch,
+	  ring_dequeue_batch },
+	{ "ring-zero", ring_inline_new, alloc_data_inline, ring_inline_enqueue, ring_inline_dequeue, free_data_inline,
+	  ring_inline_destroy, SMR_NONE, ring_inline_enqueue_batch, ring_inline_dequeue_batch },
+	{ NULL, NULL, NULL, NULL, NULL, NULL, NULL, SMR_NONE, NULL, NULL },
 };
 
 int
 main(int argc, char **argv) {
-	if (argc < 4) {
+	bool perf = false;
+	uint64_t memory = 0;
+	uint64_t rcu_stats = 0;
+	uint64_t rcu_stress_step = 0;
+	uint64_t hitm_event = 0;
+	bool matrix = false;
+	bool huge_pages = false;
+	bool prefault = false;
+	bool lock = false;
+	uint64_t prefault_mib = 0;
+	bool occupancy = false;
+	bool lifo = false;
+	unsigned int producers = 0, consumers = 0;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "a:ps:f::m::q:r::", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			if (strcmp(optarg, "all") == 0) {
+				matrix = true;
+			} else if (!allocator_set(optarg)) {
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case 'p':
+			perf = true;
+			break;
+		case OPT_HITM_EVENT:
+			hitm_event = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			phase_rate = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			fairness_enabled = true;
+			if (optarg != NULL) {
+				fairness_threshold = strtoull(optarg, NULL, 0) * NS_PER_US;
+			}
+			break;
+		case 'm':
+			memory = (optarg != NULL) ? strtoull(optarg, NULL, 0) : 10;
+			break;
+		case 'q':
+			rcu_qsbr_period = strtoull(optarg, NULL, 0);
+			if (rcu_qsbr_period == 0) {
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case 'r':
+			rcu_stats = (optarg != NULL) ? strtoull(optarg, NULL, 0) : 10;
+			break;
+		case OPT_RCU_STRESS:
+			rcu_stress_step = (optarg != NULL) ? strtoull(optarg, NULL, 0) : 500;
+			break;
+		case OPT_STALL:
+			stall_ms = (optarg != NULL) ? strtoull(optarg, NULL, 0) : 100;
+			break;
+		case OPT_HUGE_PAGES:
+			if (!hugemem_set((optarg != NULL) ? optarg : "thp")) {
+				usage(argc, argv);
+				exit(1);
+			}
+			huge_pages = true;
+			break;
+		case OPT_PREFAULT:
+			prefault = true;
+			prefault_mib = (optarg != NULL) ? strtoull(optarg, NULL, 0) : 0;
+			break;
+		case OPT_MLOCK:
+			lock = true;
+			break;
+		case OPT_BULK_PREFILL:
+			bulk_prefill = true;
+			break;
+		case OPT_OCCUPANCY:
+			bounded_enabled = true;
+			bounded_occupancy = strtoull(optarg, NULL, 0);
+			occupancy = true;
+			break;
+		case OPT_CAPACITY:
+			bounded_enabled = true;
+			bounded_capacity = strtoll(optarg, NULL, 0);
+			if (bounded_capacity <= 0) {
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case OPT_ROLES:
+			if (sscanf(optarg, "%u:%u", &producers, &consumers) != 2 || producers == 0 || consumers == 0 ||
+			    producers + consumers > UINT8_MAX)
+			{
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case OPT_SOJOURN:
+			sojourn_enabled = true;
+			break;
+		case OPT_LIFO:
+			lifo = true;
+			break;
+		case OPT_BATCH:
+			batch_size = strtoull(optarg, NULL, 0);
+			if (batch_size == 0 || batch_size > BATCH_MAX) {
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case OPT_WAIT:
+			if (strcmp(optarg, "spin") == 0) {
+				bounded_park = false;
+			} else if (strcmp(optarg, "park") == 0) {
+				bounded_park = true;
+			} else {
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		default:
+			usage(argc, argv);
+			exit(1);
+		}
+	}
+
+	char **args = argv + optind;
+	int nargs = argc - optind;
+
+	if (nargs < 3) {
 		usage(argc, argv);
 		exit(1);
 	}
 
-	uint8_t num_threads = atoi(argv[1]);
-	uint64_t num_ops = atoll(argv[2]);
-	uint8_t rws = atoi(argv[3]);
+	uint8_t num_threads = atoi(args[0]);
+	uint64_t num_ops = atoll(args[1]);
+	if (producers != 0) {
+		num_threads = producers + consumers;
+	}
+	/* Every op moves a whole batch */
+	size_t op_elements = (batch_size != 0) ? batch_size : 1;
+	ring_headroom = num_ops * num_threads * op_elements;
+	bench_nthreads = num_threads;
+	uint8_t rws = atoi(args[2]);
 	uint64_t writes = 0;
 	uint64_t reads = 0;
 	pthread_rwlockattr_t attr;
 
-	if (argc > 4) {
+	perf_init(perf, hitm_event);
+	hugemem_options(prefault, lock);
+
+	if (nargs > 3) {
 		int r;
-		if (argv[4][0] == 'r') {
+		if (args[3][0] == 'r') {
 			r = pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_READER_NP);
-		} else if (argv[4][0] == 'w') {
+		} else if (args[3][0] == 'w') {
 			r = pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NP);
-		} else if (argv[4][0] == 'n') {
+		} else if (args[3][0] == 'n') {
 			r = pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
 		} else {
 			usage(argc, argv);
@@ -410,11 +2992,31 @@ main(int argc, char **argv) {
 		assert(r == 0);
 	}
 
+	if (bounded_enabled) {
+		/* The bounded mode counts single elements */
+		if (batch_size != 0) {
+			usage(argc, argv);
+			exit(1);
+		}
+		if (!occupancy) {
+			bounded_occupancy = bounded_capacity / 2;
+		}
+		if (bounded_capacity != 0 && bounded_occupancy > (uint64_t)bounded_capacity) {
+			usage(argc, argv);
+			exit(1);
+		}
+
+		int r = uv_mutex_init(&bounded_lock);
+		assert(r == 0);
+		r = uv_cond_init(&bounded_cond);
+		assert(r == 0);
+	}
+
 	random_init();
 
 	threads = calloc(num_threads, sizeof(threads[0]));
 
-	rnd = calloc(num_ops, sizeof(rnd[0]));
+	rnd = hugemem_alloc(num_ops * sizeof(rnd[0]));
 	random_buf(rnd, num_ops * sizeof(rnd[0]));
 
 	uint32_t tmp = (rws * 255) / 100;
@@ -428,69 +3030,265 @@ main(int argc, char **argv) {
 		}
 	}
 
-	printf("%10s | %10s | %10s | %10s | %10s \n", "", "threads", "reads", "writes", "seconds");
+	if (prefault && (matrix || allocator_get() == ALLOCATOR_POOL || allocator_get() == ALLOCATOR_MCTX)) {
+		/* The prefilled queue and the nodes enqueued during the run */
+		size_t size = (prefault_mib != 0) ? prefault_mib * 1024 * 1024
+						  : 2 * num_ops * num_threads * op_elements * sizeof(struct data);
+		hugemem_reserve(size);
+	}
 
-	for (struct test *test = test_list; test->name != NULL; test++) {
-		uv_mutex_t mutex;
-		pthread_rwlock_t rwlock;
-		uv_barrier_t barrier;
-		rwlock_t crwwp;
+	if (stall_ms != 0 && rcu_stats == 0) {
+		/* The backlog columns show the worst case held memory */
+		rcu_stats = 10;
+	}
 
-		int r = uv_barrier_init(&barrier, num_threads);
-		assert(r == 0);
+	if (rcu_stress_step != 0) {
+		rcustat_enabled = true;
+		printf("%10s | %10s | %10s | %10s | %10s | %10s | %s\n", "", "target/s", "dequeues/s", "cbs@half",
+		       "cbs@end", "avg gp", "backlog");
+		for (struct test *test = test_list; test->name != NULL; test++) {
+			if (test->smr != SMR_NONE && (!lifo || test->lifo)) {
+				rcu_stress(test, threads, num_threads, rcu_stress_step);
+			}
+		}
+		goto cleanup;
+	}
 
-		r = uv_mutex_init(&mutex);
-		assert(r == 0);
+	printf("%10s ", "");
+	if (matrix) {
+		printf("| %11s ", "allocator");
+	}
+	printf("| %10s | %10s | %10s | %10s | %10s | %10s ", "threads", "reads", "writes", "seconds", "setup",
+	       "teardown");
+	if (bounded_enabled) {
+		printf("| %10s | %10s | %10s ", "ops/s", "empty", "full");
+	}
+	if (producers != 0) {
+		printf("| %10s | %10s ", "prod op/s", "cons op/s");
+	}
+	if (batch_size != 0) {
+		printf("| %10s | %10s ", "batch", "elem/s");
+	}
+	if (sojourn_enabled) {
+		sojourn_print_header();
+	}
+	if (perf_enabled()) {
+		perf_print_header();
+	}
+	if (phase_rate != 0) {
+		phase_print_header();
+	}
+	if (fairness_enabled) {
+		fairness_print_header();
+	}
+	if (memory != 0) {
+		mem_print_header();
+	}
+	if (rcu_stats != 0) {
+		rcustat_enabled = true;
+		rcustat_print_header();
+	}
+	if (huge_pages || prefault || lock) {
+		hugemem_print_header();
+	}
+	printf("\n");
 
-		r = pthread_rwlock_init(&rwlock, &attr);
-		assert(r == 0);
+	enum allocator alloc_first = matrix ? 0 : allocator_get();
+	enum allocator alloc_last = matrix ? ALLOCATOR_MAX - 1 : allocator_get();
 
-		rwlock_setworkers(num_threads);
-		rwlock_init(&crwwp);
+	for (struct test *test = test_list; test->name != NULL; test++) {
+		if (lifo && !test->lifo) {
+			continue;
+		}
+		for (enum allocator a = alloc_first; a <= alloc_last; a++) {
+			allocator_select(a);
 
-		void *data = test->new(num_ops * num_threads);
+			uv_mutex_t mutex;
+			pthread_rwlock_t rwlock;
+			uv_barrier_t barrier;
+			rwlock_t crwwp;
 
-		for (size_t i = 0; i < num_threads; i++) {
-			struct thread_s *t = &threads[i];
-			*t = (struct thread_s){
-				.barrier = &barrier,
-				.mutex = &mutex,
-				.rwlock = &rwlock,
-				.crwwp = &crwwp,
-				.ops = num_ops,
-				.rws = rws,
-				.data = data,
-			};
+			int r = uv_barrier_init(&barrier, num_threads);
+			assert(r == 0);
 
-			r = uv_thread_create(&t->thread, test->run, t);
+			r = uv_mutex_init(&mutex);
 			assert(r == 0);
-		}
 
-		uint64_t diff = 0;
-		writes = 0;
-		reads = 0;
-		for (size_t i = 0; i < num_threads; i++) {
-			struct thread_s *t = &threads[i];
-			r = uv_thread_join(&t->thread);
+			r = pthread_rwlock_init(&rwlock, &attr);
 			assert(r == 0);
 
-			diff += t->diff;
-			writes += t->writes;
-			reads += t->reads;
-		}
+			rwlock_setworkers(num_threads);
+			rwlock_init(&crwwp);
 
-		printf("%10s | %10zu | %10" PRIu64 " | %10" PRIu64 " | %10.4f \n", test->name, (size_t)num_threads,
-		       reads, writes, (double)(diff / num_threads) / (US_PER_SEC));
+			uint64_t setup = uv_hrtime();
+			size_t nelements = bounded_enabled ? bounded_occupancy : num_ops * num_threads * op_elements;
+			void *data = test->new(nelements);
+			setup = uv_hrtime() - setup;
 
-		test->destroy(data);
+			if (bounded_enabled) {
+				bounded_reset(nelements, num_threads);
+			}
 
-		rwlock_destroy(&crwwp);
-		uv_mutex_destroy(&mutex);
-		pthread_rwlock_destroy(&rwlock);
-		uv_barrier_destroy(&barrier);
+			if (memory != 0) {
+				mem_sampler_start(memory);
+			}
+			if (rcu_stats != 0 && test->smr != SMR_NONE) {
+				smr_sampler_start(test, rcu_stats, stderr);
+			}
+
+			for (size_t i = 0; i < num_threads; i++) {
+				struct thread_s *t = &threads[i];
+				*t = (struct thread_s){
+					.barrier = &barrier,
+					.mutex = &mutex,
+					.rwlock = &rwlock,
+					.crwwp = &crwwp,
+					.ops = num_ops,
+					.rws = rws,
+					.data = data,
+					.test = test,
+				};
+				if (producers != 0) {
+					/* The consumers come first, the stall hits the first thread */
+					t->role = (i < consumers) ? ROLE_CONSUMER : ROLE_PRODUCER;
+					if (t->role == ROLE_CONSUMER) {
+						/* Dequeue as many nodes as the producers enqueue */
+						t->ops = num_ops * producers / consumers;
+					}
+				}
+				if (sojourn_enabled) {
+					sojourn_init(&t->sojourn, num_threads);
+				}
+
+				r = uv_thread_create(&t->thread, queue_run, t);
+				assert(r == 0);
+			}
+
+			uint64_t diff = 0;
+			uint64_t empty = 0;
+			uint64_t full = 0;
+			uint64_t elements = 0;
+			uint64_t retries = 0;
+			struct sojourn sojourn_sum = { 0 };
+			double producer_ops_per_sec = 0.0, consumer_ops_per_sec = 0.0;
+			struct perf_counters perf_sum;
+			struct phases phase_sum = { 0 };
+			double ops_per_sec[num_threads];
+			struct fairness fairness[num_threads];
+			perf_reset(&perf_sum);
+			writes = 0;
+			reads = 0;
+			for (size_t i = 0; i < num_threads; i++) {
+				struct thread_s *t = &threads[i];
+				r = uv_thread_join(&t->thread);
+				assert(r == 0);
+
+				diff += t->diff;
+				writes += t->writes;
+				reads += t->reads;
+				empty += t->empty;
+				full += t->full;
+				elements += t->elements;
+				retries += t->retries;
+				if (sojourn_enabled) {
+					sojourn_add(&sojourn_sum, &t->sojourn);
+					sojourn_destroy(&t->sojourn);
+				}
+				perf_add(&perf_sum, &t->perf);
+				phase_add(&phase_sum, &t->phases);
+				ops_per_sec[i] = (t->diff > 0) ? (double)(t->reads + t->writes) * US_PER_SEC / t->diff : 0.0;
+				if (t->role == ROLE_PRODUCER) {
+					producer_ops_per_sec += ops_per_sec[i];
+				} else if (t->role == ROLE_CONSUMER) {
+					consumer_ops_per_sec += ops_per_sec[i];
+				}
+				fairness[i] = t->fairness;
+			}
+
+			struct rcustat_summary rcu_summary;
+			if (rcu_stats != 0 && test->smr != SMR_NONE) {
+				rcustat_sampler_stop(&rcu_summary);
+			}
+
+			struct mem_sample mem_peak, mem_end, mem_post;
+			if (memory != 0) {
+				mem_sampler_stop(&mem_peak);
+				mem_sample(&mem_end);
+			}
+
+			uint64_t teardown = uv_hrtime();
+			test->destroy(data);
+			teardown = uv_hrtime() - teardown;
+
+			/*
+			 * The exited threads have left their retired nodes behind,
+			 * drain them so they are neither counted in the teardown
+			 * sample nor in the RCU counters of the next backend.
+			 */
+			rcu_barrier();
+			ebr_barrier();
+			hp_barrier();
+
+			if (memory != 0) {
+				mem_sample(&mem_post);
+			}
+
+			printf("%10s ", test->name);
+			if (matrix) {
+				printf("| %11s ", allocator_name());
+			}
+			printf("| %10zu | %10" PRIu64 " | %10" PRIu64 " | %10.4f | %10.4f | %10.4f ", (size_t)num_threads,
+			       reads, writes, (double)(diff / num_threads) / (US_PER_SEC), (double)setup / NS_PER_SEC,
+			       (double)teardown / NS_PER_SEC);
+			if (bounded_enabled) {
+				double seconds = (double)(diff / num_threads) / US_PER_SEC;
+				printf("| %10.0f | %10" PRIu64 " | %10" PRIu64 " ",
+				       (seconds > 0.0) ? (double)(reads + writes) / seconds : 0.0, empty, full);
+			}
+			if (producers != 0) {
+				printf("| %10.0f | %10.0f ", producer_ops_per_sec, consumer_ops_per_sec);
+			}
+			if (batch_size != 0) {
+				double seconds = (double)(diff / num_threads) / US_PER_SEC;
+				printf("| %10zu | %10.0f ", batch_size, (seconds > 0.0) ? (double)elements / seconds : 0.0);
+			}
+			if (sojourn_enabled) {
+				sojourn_print(&sojourn_sum);
+			}
+			if (perf_enabled()) {
+				perf_print(&perf_sum, reads + writes);
+			}
+			if (phase_rate != 0) {
+				phase_print(&phase_sum);
+			}
+			if (fairness_enabled) {
+				fairness_print(test->name, ops_per_sec, fairness, num_threads);
+			}
+			if (memory != 0) {
+				mem_print(&mem_peak, &mem_end, &mem_post);
+			}
+			if (rcu_stats != 0) {
+				rcustat_print((test->smr != SMR_NONE) ? &rcu_summary : NULL);
+			}
+			if (huge_pages || prefault || lock) {
+				hugemem_print();
+			}
+			printf("\n");
+			if (retries != 0) {
+				/* Keep the table intact, like the rcustat series */
+				fprintf(stderr, "%10s: %" PRIu64 " dequeues lost the race for a reused node and retried\n",
+					test->name, retries);
+			}
+
+			rwlock_destroy(&crwwp);
+			uv_mutex_destroy(&mutex);
+			pthread_rwlock_destroy(&rwlock);
+			uv_barrier_destroy(&barrier);
+		}
 	}
 
-	free(rnd);
+cleanup:
+	hugemem_free(rnd, num_ops * sizeof(rnd[0]));
 
 	return 0;
 }
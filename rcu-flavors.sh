@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# SPDX-FileCopyrightText: 2024 Ondřej Surý
+#
+# SPDX-License-Identifier: WTFPL
+#
+# Run the benchmark built against every urcu flavor and print the rows
+# side by side, grouped by backend, with the flavor as the first column.
+#
+# usage: rcu-flavors.sh <builddir> <list-bench|queue-bench> <args>...
+
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 <builddir> <list-bench|queue-bench> <args>..." >&2
+	exit 1
+fi
+
+builddir="$1"
+bench="$2"
+shift 2
+
+tmp=$(mktemp)
+trap 'rm -f "$tmp"' EXIT
+
+for flavor in memb mb qsbr bp; do
+	exe="$builddir/$bench"
+	if [ "$flavor" != "memb" ]; then
+		exe="$exe-$flavor"
+	fi
+	if [ ! -x "$exe" ]; then
+		echo "$exe: not found, skipping" >&2
+		continue
+	fi
+	"$exe" "$@" | sed "s/^/$(printf '%10s' "$flavor") | /" >>"$tmp"
+done
+
+# The table header is the line with an empty backend name, the rows are
+# kept in the order the backends first appear in.
+awk -F'|' '
+	$2 ~ /^ *$/ { if (!header) { header = $0; sub(/^ *[^ ]+ /, sprintf("%10s ", "flavor"), header) } next }
+	{ if (!($2 in order)) { order[$2] = ++nbackends; names[nbackends] = $2 } rows[$2] = rows[$2] $0 "\n" }
+	END { if (header) print header; for (i = 1; i <= nbackends; i++) printf "%s", rows[names[i]] }
+' "$tmp"
@@ -0,0 +1,61 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file rcu.h
+ * Userspace RCU flavor selection.
+ *
+ * The flavor is chosen at build time by defining one of RCU_MEMB (the
+ * default), RCU_MB, RCU_QSBR or RCU_BP; the unprefixed urcu API then maps
+ * to the selected flavor.
+ *
+ * With QSBR the read-side critical sections are free, but every registered
+ * thread has to announce a quiescent state regularly and has to go offline
+ * before blocking, which is what rcu_quiescent() and rcu_offline() /
+ * rcu_online() do.  With the other flavors they compile to nothing.
+ */
+
+#include <stdint.h>
+
+#if defined(RCU_QSBR)
+#include <urcu-qsbr.h>
+#define RCU_FLAVOR "qsbr"
+#elif defined(RCU_BP)
+#include <urcu-bp.h>
+#define RCU_FLAVOR "bp"
+#elif defined(RCU_MB)
+#include <urcu.h>
+#define RCU_FLAVOR "mb"
+#else /* if defined(RCU_QSBR) */
+#ifndef RCU_MEMB
+#define RCU_MEMB 1
+#endif /* ifndef RCU_MEMB */
+#include <urcu.h>
+#define RCU_FLAVOR "memb"
+#endif /* if defined(RCU_QSBR) */
+
+#include <urcu/cds.h>
+
+/*
+ * Announce a quiescent state every rcu_qsbr_period operations.
+ */
+[[maybe_unused]] static uint64_t rcu_qsbr_period = 1;
+
+#if defined(RCU_QSBR)
+#define rcu_quiescent(op)                          \
+	do {                                       \
+		if ((op) % rcu_qsbr_period == 0) { \
+			rcu_quiescent_state();     \
+		}                                  \
+	} while (0)
+#define rcu_offline() rcu_thread_offline()
+#define rcu_online()  rcu_thread_online()
+#else /* if defined(RCU_QSBR) */
+#define rcu_quiescent(op) (void)(op)
+#define rcu_offline()
+#define rcu_online()
+#endif /* if defined(RCU_QSBR) */
@@ -0,0 +1,130 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <uv.h>
+
+#include "atomic.h"
+#include "rcustat.h"
+
+bool rcustat_enabled = false;
+struct rcustat rcustat;
+
+static uv_thread_t sampler;
+static atomic_bool sampler_running;
+static uint64_t sampler_interval;
+static const char *sampler_name;
+static FILE *sampler_series;
+static void (*sampler_synchronize)(void);
+static struct rcustat_summary sampler_summary;
+
+static void
+sampler_run(void *arg [[maybe_unused]]) {
+	uint64_t start = uv_hrtime();
+	uint64_t last = start;
+	uint64_t last_processed = 0;
+
+	while (atomic_load_acquire(&sampler_running)) {
+		uv_sleep(sampler_interval);
+
+		/* The time a writer waiting for the readers would block */
+		uint64_t gp_start = uv_hrtime();
+		if (sampler_synchronize != NULL) {
+			sampler_synchronize();
+		}
+		uint64_t now = uv_hrtime();
+		uint64_t gp = now - gp_start;
+
+		uint64_t processed = atomic_load_relaxed(&rcustat.processed);
+		uint64_t outstanding = rcustat_outstanding();
+		int64_t pending = atomic_load_relaxed(&rcustat.pending_bytes);
+		double rate = (double)(processed - last_processed) * 1000000000 / (now - last);
+
+		if (sampler_synchronize != NULL) {
+			sampler_summary.gp_count++;
+			sampler_summary.gp_total_ns += gp;
+			if (gp > sampler_summary.gp_max_ns) {
+				sampler_summary.gp_max_ns = gp;
+			}
+		}
+		if (outstanding > sampler_summary.max_outstanding) {
+			sampler_summary.max_outstanding = outstanding;
+		}
+		if (pending > sampler_summary.max_pending_bytes) {
+			sampler_summary.max_pending_bytes = pending;
+		}
+
+		if (sampler_series != NULL) {
+			fprintf(sampler_series, "%s %.3f %" PRIu64 " %.0f %.3f %" PRId64 "\n", sampler_name,
+				(double)(now - start) / 1000000, outstanding, rate, (double)gp / 1000, pending);
+		}
+
+		last = now;
+		last_processed = processed;
+	}
+}
+
+void
+rcustat_sampler_start(const char *name, uint64_t interval_ms, FILE *series, void (*synchronize)(void)) {
+	atomic_store_relaxed(&rcustat.queued, 0);
+	atomic_store_relaxed(&rcustat.processed, 0);
+	atomic_store_relaxed(&rcustat.pending_bytes, 0);
+
+	sampler_summary = (struct rcustat_summary){ 0 };
+	sampler_interval = interval_ms;
+	sampler_name = name;
+	sampler_synchronize = synchronize;
+	sampler_series = series;
+	if (series != NULL) {
+		fprintf(series, "# backend ms outstanding processed/s gp-us pending-bytes\n");
+	}
+
+	atomic_store_release(&sampler_running, true);
+
+	int r = uv_thread_create(&sampler, sampler_run, NULL);
+	assert(r == 0);
+}
+
+void
+rcustat_sampler_stop(struct rcustat_summary *summary) {
+	atomic_store_release(&sampler_running, false);
+
+	int r = uv_thread_join(&sampler);
+	assert(r == 0);
+
+	sampler_summary.processed = atomic_load_relaxed(&rcustat.processed);
+
+	*summary = sampler_summary;
+}
+
+void
+rcustat_print_header(void) {
+	printf("| %10s | %10s | %10s | %10s ", "max cbs", "max held", "avg gp", "max gp");
+}
+
+void
+rcustat_print(const struct rcustat_summary *summary) {
+	if (summary == NULL) {
+		printf("| %10s | %10s | %10s | %10s ", "-", "-", "-", "-");
+		return;
+	}
+	printf("| %10" PRIu64 " | %7.1fMiB ", summary->max_outstanding,
+	       (double)summary->max_pending_bytes / (1024.0 * 1024.0));
+	if (summary->gp_count == 0) {
+		printf("| %10s | %10s ", "-", "-");
+		return;
+	}
+	printf("| %8.1fus | %8.1fus ", (double)summary->gp_total_ns / summary->gp_count / 1000,
+	       (double)summary->gp_max_ns / 1000);
+}
@@ -0,0 +1,91 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file rcustat.h
+ * RCU grace-period and call_rcu() callback backlog instrumentation.
+ *
+ * The callers account every call_rcu() with rcustat_queued() and every
+ * executed callback with rcustat_processed().  A sampler thread writes a
+ * time series of the outstanding callbacks, callbacks processed per
+ * second, the grace-period duration (measured by timing synchronize_rcu()
+ * or its equivalent from the sampler) and the memory held pending
+ * reclamation.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "atomic.h"
+
+struct rcustat {
+	atomic_uint_fast64_t queued;
+	atomic_uint_fast64_t processed;
+	atomic_int_fast64_t pending_bytes;
+};
+
+struct rcustat_summary {
+	uint64_t max_outstanding;
+	int64_t max_pending_bytes;
+	uint64_t processed;
+	uint64_t gp_count;
+	uint64_t gp_total_ns;
+	uint64_t gp_max_ns;
+};
+
+extern bool rcustat_enabled;
+extern struct rcustat rcustat;
+
+static inline void
+rcustat_queued(size_t bytes) {
+	if (!rcustat_enabled) {
+		return;
+	}
+	(void)atomic_fetch_add_relaxed(&rcustat.queued, 1);
+	(void)atomic_fetch_add_relaxed(&rcustat.pending_bytes, bytes);
+}
+
+static inline void
+rcustat_processed(size_t bytes) {
+	if (!rcustat_enabled) {
+		return;
+	}
+	(void)atomic_fetch_add_relaxed(&rcustat.processed, 1);
+	(void)atomic_fetch_sub_relaxed(&rcustat.pending_bytes, bytes);
+}
+
+static inline uint64_t
+rcustat_outstanding(void) {
+	uint64_t processed = atomic_load_relaxed(&rcustat.processed);
+	uint64_t queued = atomic_load_relaxed(&rcustat.queued);
+
+	return ((queued > processed) ? queued - processed : 0);
+}
+
+void
+rcustat_sampler_start(const char *name, uint64_t interval_ms, FILE *series, void (*synchronize)(void));
+/*%<
+ * Reset the counters and start sampling every 'interval_ms', each sample
+ * is written as one line prefixed with 'name' to 'series' (if not NULL).
+ * 'synchronize' waits for a grace period of the reclamation scheme under
+ * test, e.g. synchronize_rcu(), or is NULL when the scheme has none.
+ */
+
+void
+rcustat_sampler_stop(struct rcustat_summary *summary);
+
+void
+rcustat_print_header(void);
+
+void
+rcustat_print(const struct rcustat_summary *summary);
+/*%<
+ * Print the summary columns, or empty columns when 'summary' is NULL.
+ */
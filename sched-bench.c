@@ -0,0 +1,539 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+/*
+ * Fork-join task scheduler benchmark.
+ *
+ * Every worker runs tasks until the root task of the tree completes.  A
+ * task either completes on the spot, or spawns its children and completes
+ * when its last child does (a continuation-style join, the worker never
+ * blocks on a join).  Two trees are run:
+ *
+ *  - fib: the recursive Fibonacci, a regular binary tree that is deep on
+ *    one side and shallow on the other,
+ *  - uts: the binomial tree of the Unbalanced Tree Search benchmark, the
+ *    root has <root> children and every other node has <m> children with
+ *    the probability <q>, so the subtrees vary wildly in size.  The tree
+ *    is derived from the node seeds, it's the same on every run.
+ *
+ * The "chase-lev" scheduler keeps the tasks in a Chase-Lev deque per
+ * worker, a worker runs its own newest task first and steals the oldest
+ * task of a random victim when its deque is empty.  The "mutex" scheduler
+ * is the baseline, all workers share a single FIFO queue under one mutex,
+ * the same structure as the mutex queue of queue-bench.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <urcu/list.h>
+#include <uv.h>
+
+#include "atomic.h"
+#include "chaselev.h"
+#include "pool.h"
+#include "util.h"
+
+struct task {
+	struct task *parent;
+	atomic_uint_fast64_t pending; /* Children that have not completed yet */
+	atomic_uint_fast64_t result;
+	uint64_t arg; /* fib: the argument, uts: the node seed */
+	uint32_t depth;
+	struct cds_list_head head;
+};
+
+struct run;
+
+struct worker {
+	uv_thread_t thread;
+	struct run *run;
+	size_t id;
+	struct chaselev *deque;
+	uint64_t tasks;
+	uint64_t steals;
+};
+
+struct scheduler {
+	const char *name;
+	void (*new)(struct run *run);
+	void (*destroy)(struct run *run);
+	void (*spawn)(struct worker *worker, struct task *task);
+	struct task *(*next)(struct worker *worker);
+	/* Optional, called when there's no task in next() */
+	struct task *(*steal)(struct worker *worker);
+};
+
+struct tree {
+	const char *name;
+	struct task *(*root)(void);
+	void (*run)(struct worker *worker, struct task *task);
+};
+
+struct run {
+	const struct scheduler *scheduler;
+	const struct tree *tree;
+	struct worker *workers;
+	size_t nworkers;
+	uv_barrier_t barrier;
+	atomic_bool done;
+	uint64_t result;
+
+	/* The mutex scheduler */
+	uv_mutex_t lock;
+	struct cds_list_head queue;
+};
+
+static uint64_t fib_n = 30;
+static size_t uts_root = 2000;
+static size_t uts_m = 5;
+static double uts_q = 0.199;
+static uint64_t work = 0;
+
+/*
+ * Tasks
+ */
+
+static struct task *
+task_new(struct task *parent, uint64_t arg, uint32_t depth) {
+	struct task *task = pool_alloc(sizeof(*task));
+
+	*task = (struct task){
+		.parent = parent,
+		.arg = arg,
+		.depth = depth,
+	};
+
+	return (task);
+}
+
+static void
+task_spawn(struct worker *worker, struct task *parent, uint64_t arg) {
+	struct task *task = task_new(parent, arg, parent->depth + 1);
+
+	worker->run->scheduler->spawn(worker, task);
+}
+
+/*
+ * Pass the result up the tree, the last child to complete completes its
+ * parent, and the root completes the run.
+ */
+static void
+task_complete(struct worker *worker, struct task *task) {
+	struct run *run = worker->run;
+
+	for (;;) {
+		struct task *parent = task->parent;
+		uint64_t result = atomic_load_relaxed(&task->result);
+
+		pool_free(task, sizeof(*task));
+
+		if (parent == NULL) {
+			run->result = result;
+			atomic_store_release(&run->done, true);
+			return;
+		}
+
+		(void)atomic_fetch_add_relaxed(&parent->result, result);
+		if (atomic_fetch_sub_acq_rel(&parent->pending, 1) != 1) {
+			return;
+		}
+		task = parent;
+	}
+}
+
+static void
+task_work(void) {
+	for (uint64_t i = 0; i < work; i++) {
+		atomic_signal_fence(memory_order_seq_cst);
+	}
+}
+
+/*
+ * Trees
+ */
+
+static struct task *
+fib_root(void) {
+	return (task_new(NULL, fib_n, 0));
+}
+
+static void
+fib_run(struct worker *worker, struct task *task) {
+	task_work();
+
+	if (task->arg < 2) {
+		atomic_store_relaxed(&task->result, task->arg);
+		task_complete(worker, task);
+		return;
+	}
+
+	/* The task can complete as soon as the second child is spawned */
+	uint64_t arg = task->arg;
+	atomic_store_relaxed(&task->pending, 2);
+	task_spawn(worker, task, arg - 1);
+	task_spawn(worker, task, arg - 2);
+}
+
+static uint64_t
+splitmix64(uint64_t x) {
+	x += 0x9e3779b97f4a7c15;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+	return (x ^ (x >> 31));
+}
+
+static struct task *
+uts_root_new(void) {
+	return (task_new(NULL, 42, 0));
+}
+
+static void
+uts_run(struct worker *worker, struct task *task) {
+	size_t n = uts_root;
+
+	task_work();
+
+	if (task->depth > 0) {
+		double draw = (double)(splitmix64(task->arg) >> 11) * 0x1.0p-53;
+		n = (draw < uts_q) ? uts_m : 0;
+	}
+
+	/* The result is the number of the nodes in the subtree */
+	atomic_store_relaxed(&task->result, 1);
+
+	if (n == 0) {
+		task_complete(worker, task);
+		return;
+	}
+
+	uint64_t seed = task->arg;
+	atomic_store_relaxed(&task->pending, n);
+	for (size_t i = 0; i < n; i++) {
+		task_spawn(worker, task, splitmix64(seed ^ ((i + 1) * 0xd1b54a32d192ed03)));
+	}
+}
+
+static const struct tree trees[] = {
+	{ "fib", fib_root, fib_run },
+	{ "uts", uts_root_new, uts_run },
+};
+
+/*
+ * Schedulers
+ */
+
+static void
+chaselev_sched_new(struct run *run) {
+	for (size_t i = 0; i < run->nworkers; i++) {
+		run->workers[i].deque = chaselev_new();
+	}
+}
+
+static void
+chaselev_sched_destroy(struct run *run) {
+	for (size_t i = 0; i < run->nworkers; i++) {
+		void *task = chaselev_pop(run->workers[i].deque);
+		assert(task == NULL);
+		chaselev_destroy(run->workers[i].deque);
+	}
+}
+
+static void
+chaselev_spawn(struct worker *worker, struct task *task) {
+	chaselev_push(worker->deque, task);
+}
+
+static struct task *
+chaselev_next(struct worker *worker) {
+	return (chaselev_pop(worker->deque));
+}
+
+static struct task *
+chaselev_steal_random(struct worker *worker) {
+	struct run *run = worker->run;
+
+	if (run->nworkers < 2) {
+		return (NULL);
+	}
+
+	size_t victim = next() % (run->nworkers - 1);
+	if (victim >= worker->id) {
+		victim++;
+	}
+
+	struct task *task = chaselev_steal(run->workers[victim].deque);
+	if (task != NULL) {
+		worker->steals++;
+	}
+
+	return (task);
+}
+
+static void
+mutex_sched_new(struct run *run) {
+	int r = uv_mutex_init(&run->lock);
+	assert(r == 0);
+
+	CDS_INIT_LIST_HEAD(&run->queue);
+}
+
+static void
+mutex_sched_destroy(struct run *run) {
+	assert(cds_list_empty(&run->queue));
+
+	uv_mutex_destroy(&run->lock);
+}
+
+static void
+mutex_spawn(struct worker *worker, struct task *task) {
+	struct run *run = worker->run;
+
+	uv_mutex_lock(&run->lock);
+	cds_list_add_tail(&task->head, &run->queue);
+	uv_mutex_unlock(&run->lock);
+}
+
+static struct task *
+mutex_next(struct worker *worker) {
+	struct run *run = worker->run;
+	struct task *task = NULL;
+
+	uv_mutex_lock(&run->lock);
+	if (!cds_list_empty(&run->queue)) {
+		task = cds_list_first_entry(&run->queue, struct task, head);
+		cds_list_del(&task->head);
+	}
+	uv_mutex_unlock(&run->lock);
+
+	return (task);
+}
+
+static const struct scheduler schedulers[] = {
+	{ "chase-lev", chaselev_sched_new, chaselev_sched_destroy, chaselev_spawn, chaselev_next,
+	  chaselev_steal_random },
+	{ "mutex", mutex_sched_new, mutex_sched_destroy, mutex_spawn, mutex_next, NULL },
+};
+
+static const struct scheduler *
+scheduler_find(const char *name) {
+	for (size_t i = 0; i < sizeof(schedulers) / sizeof(schedulers[0]); i++) {
+		if (strcmp(name, schedulers[i].name) == 0) {
+			return (&schedulers[i]);
+		}
+	}
+
+	return (NULL);
+}
+
+static const struct tree *
+tree_find(const char *name) {
+	for (size_t i = 0; i < sizeof(trees) / sizeof(trees[0]); i++) {
+		if (strcmp(name, trees[i].name) == 0) {
+			return (&trees[i]);
+		}
+	}
+
+	return (NULL);
+}
+
+static void
+worker_run(void *arg0) {
+	struct worker *worker = arg0;
+	struct run *run = worker->run;
+	const struct scheduler *scheduler = run->scheduler;
+
+	random_init();
+
+	(void)uv_barrier_wait(&run->barrier);
+
+	while (!atomic_load_acquire(&run->done)) {
+		struct task *task = scheduler->next(worker);
+
+		if (task == NULL && scheduler->steal != NULL) {
+			task = scheduler->steal(worker);
+		}
+		if (task == NULL) {
+			pause();
+			continue;
+		}
+
+		worker->tasks++;
+		run->tree->run(worker, task);
+	}
+}
+
+static void
+run_one(const struct scheduler *scheduler, const struct tree *tree, size_t nworkers) {
+	struct run run = {
+		.scheduler = scheduler,
+		.tree = tree,
+		.workers = calloc(nworkers, sizeof(run.workers[0])),
+		.nworkers = nworkers,
+	};
+	struct timespec start, end;
+
+	int r = uv_barrier_init(&run.barrier, nworkers + 1);
+	assert(r == 0);
+
+	for (size_t i = 0; i < nworkers; i++) {
+		run.workers[i] = (struct worker){
+			.run = &run,
+			.id = i,
+		};
+	}
+
+	scheduler->new(&run);
+
+	/* The first worker starts with the root task */
+	scheduler->spawn(&run.workers[0], tree->root());
+
+	for (size_t i = 0; i < nworkers; i++) {
+		r = uv_thread_create(&run.workers[i].thread, worker_run, &run.workers[i]);
+		assert(r == 0);
+	}
+
+	/* The workers can't start before the main thread reaches the barrier */
+	time_now(&start);
+	(void)uv_barrier_wait(&run.barrier);
+
+	uint64_t tasks = 0, steals = 0;
+	for (size_t i = 0; i < nworkers; i++) {
+		r = uv_thread_join(&run.workers[i].thread);
+		assert(r == 0);
+
+		tasks += run.workers[i].tasks;
+		steals += run.workers[i].steals;
+	}
+
+	time_now(&end);
+
+	double seconds = (double)time_nanodiff(&end, &start) / NS_PER_SEC;
+
+	printf("%10s | %10zu | %10s | %12" PRIu64 " | %12" PRIu64 " | %10.4f | %12.0f | %10" PRIu64 " |\n",
+	       scheduler->name, nworkers, tree->name, tasks, run.result, seconds,
+	       (seconds > 0.0) ? (double)tasks / seconds : 0.0, steals);
+
+	scheduler->destroy(&run);
+	uv_barrier_destroy(&run.barrier);
+	free(run.workers);
+}
+
+enum {
+	OPT_FIB = 256,
+	OPT_UTS,
+	OPT_WORK,
+};
+
+static struct option long_options[] = {
+	{ "scheduler", required_argument, NULL, 's' },
+	{ "tree", required_argument, NULL, 't' },
+	{ "fib", required_argument, NULL, OPT_FIB },
+	{ "uts", required_argument, NULL, OPT_UTS },
+	{ "work", required_argument, NULL, OPT_WORK },
+	{ NULL, 0, NULL, 0 },
+};
+
+void
+usage(int argc [[maybe_unused]], char **argv) {
+	fprintf(stderr,
+		"usage: %s [options] <num_threads>\n"
+		"\n"
+		"  -s, --scheduler=<name>   run only the chase-lev or the mutex scheduler\n"
+		"  -t, --tree=<name>        run only the fib or the uts tree\n"
+		"      --fib=<n>            compute the <n>-th Fibonacci number (default 30)\n"
+		"      --uts=<root>:<m>:<q> the uts root has <root> children, the other nodes have\n"
+		"                           <m> children with probability <q> (default 2000:5:0.199)\n"
+		"      --work=<n>           spin <n> iterations in every task\n",
+		argv[0]);
+}
+
+int
+main(int argc, char **argv) {
+	const char *scheduler_name = NULL;
+	const char *tree_name = NULL;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "s:t:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 's':
+			scheduler_name = optarg;
+			break;
+		case 't':
+			tree_name = optarg;
+			break;
+		case OPT_FIB:
+			fib_n = strtoull(optarg, NULL, 10);
+			if (fib_n > 90) {
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case OPT_UTS:
+			if (sscanf(optarg, "%zu:%zu:%lf", &uts_root, &uts_m, &uts_q) != 3 || uts_root == 0 ||
+			    uts_q < 0.0 || uts_q * (double)uts_m >= 1.0)
+			{
+				/* The tree is infinite when m * q >= 1 */
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case OPT_WORK:
+			work = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			usage(argc, argv);
+			exit(1);
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage(argc, argv);
+		exit(1);
+	}
+
+	size_t nworkers = strtoul(argv[optind], NULL, 10);
+	if (nworkers == 0) {
+		usage(argc, argv);
+		exit(1);
+	}
+
+	if ((scheduler_name != NULL && scheduler_find(scheduler_name) == NULL) ||
+	    (tree_name != NULL && tree_find(tree_name) == NULL))
+	{
+		usage(argc, argv);
+		exit(1);
+	}
+
+	printf("%10s | %10s | %10s | %12s | %12s | %10s | %12s | %10s |\n", "scheduler", "threads", "tree", "tasks",
+	       "result", "seconds", "tasks/s", "steals");
+
+	for (size_t i = 0; i < sizeof(schedulers) / sizeof(schedulers[0]); i++) {
+		if (scheduler_name != NULL && &schedulers[i] != scheduler_find(scheduler_name)) {
+			continue;
+		}
+		for (size_t j = 0; j < sizeof(trees) / sizeof(trees[0]); j++) {
+			if (tree_name != NULL && &trees[j] != tree_find(tree_name)) {
+				continue;
+			}
+			run_one(&schedulers[i], &trees[j], nworkers);
+		}
+	}
+
+	return (0);
+}
@@ -0,0 +1,151 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file slab.h
+ * Per-thread slab caches shared by the pool and the mctx allocators.
+ *
+ * The objects are rounded up to whole cache lines and carved from slabs
+ * that belong to the thread cache that carved them.  The slabs are aligned
+ * to their size and the slab header in the first cache line points to the
+ * owning cache, so the owner of any object is found by masking the object
+ * address.  The caches outlive their threads: the cache of an exited
+ * thread is orphaned and adopted by the next new thread.
+ *
+ * The allocators embed struct slab_cache as the first member of their
+ * thread cache and differ only in how the objects freed by the other
+ * threads find their way back to the owner.
+ */
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <uv.h>
+
+#include "hugemem.h"
+
+#define SLAB_CACHELINE_SIZE 64
+
+/*
+ * Objects up to SLAB_CLASSES cache lines come from the slabs, the larger
+ * objects are passed to malloc().
+ */
+#define SLAB_CLASSES 4
+
+struct slab_object {
+	struct slab_object *next;
+};
+
+struct slab_cache;
+
+struct slab {
+	alignas(SLAB_CACHELINE_SIZE) struct slab_cache *owner;
+	size_t class;
+	struct slab *next;
+};
+
+struct slab_cache {
+	struct slab_object *free[SLAB_CLASSES];
+	struct slab *slabs;
+	struct slab_cache *next;
+	bool orphan;
+};
+
+/*
+ * All the thread caches of one allocator.
+ */
+struct slab_caches {
+	uv_mutex_t lock;
+	struct slab_cache *head;
+	tss_t key;
+};
+
+static inline void
+slab_caches_init(struct slab_caches *caches, void (*thread_exit)(void *cache)) {
+	int r = uv_mutex_init(&caches->lock);
+	assert(r == 0);
+
+	r = tss_create(&caches->key, thread_exit);
+	assert(r == thrd_success);
+}
+
+/*
+ * Adopt an orphaned cache, or allocate a new 'size' bytes long cache that
+ * starts with struct slab_cache and let 'init' initialize the rest of it.
+ * The cache is orphaned again when the calling thread exits.
+ */
+static inline struct slab_cache *
+slab_cache_adopt(struct slab_caches *caches, size_t size, size_t align, void (*init)(struct slab_cache *cache)) {
+	struct slab_cache *cache;
+
+	uv_mutex_lock(&caches->lock);
+	for (cache = caches->head; cache != NULL; cache = cache->next) {
+		if (cache->orphan) {
+			cache->orphan = false;
+			break;
+		}
+	}
+	if (cache == NULL) {
+		cache = aligned_alloc(align, size);
+		memset(cache, 0, size);
+		cache->next = caches->head;
+		init(cache);
+
+		caches->head = cache;
+	}
+	uv_mutex_unlock(&caches->lock);
+
+	int r = tss_set(caches->key, cache);
+	assert(r == thrd_success);
+
+	return (cache);
+}
+
+static inline void
+slab_cache_orphan(struct slab_caches *caches, struct slab_cache *cache) {
+	uv_mutex_lock(&caches->lock);
+	cache->orphan = true;
+	uv_mutex_unlock(&caches->lock);
+}
+
+static inline size_t
+slab_class(size_t size) {
+	return ((size + SLAB_CACHELINE_SIZE - 1) / SLAB_CACHELINE_SIZE - 1);
+}
+
+static inline struct slab *
+slab_of(void *ptr, size_t slab_size) {
+	return ((struct slab *)((uintptr_t)ptr & ~(uintptr_t)(slab_size - 1)));
+}
+
+/*
+ * Carve a new slab into the local free list of the 'class'.
+ */
+static inline void
+slab_new(struct slab_cache *cache, size_t class, size_t slab_size) {
+	struct slab *slab = hugemem_slab(slab_size);
+	size_t size = (class + 1) * SLAB_CACHELINE_SIZE;
+	uint8_t *base = (uint8_t *)slab;
+
+	*slab = (struct slab){
+		.owner = cache,
+		.class = class,
+		.next = cache->slabs,
+	};
+	cache->slabs = slab;
+
+	for (size_t off = sizeof(*slab); off + size <= slab_size; off += size) {
+		struct slab_object *object = (struct slab_object *)(base + off);
+		object->next = cache->free[class];
+		cache->free[class] = object;
+	}
+}
@@ -0,0 +1,175 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file sojourn.h
+ * Enqueue-to-dequeue latency of the queue elements.
+ *
+ * Every element is timestamped by its producer right before the enqueue,
+ * and the consumer records the time the element has spent in the queue
+ * into a log-linear histogram (SOJOURN_SUB_BITS of mantissa, so the
+ * reported percentiles are within 1/2^SOJOURN_SUB_BITS of the real ones).
+ *
+ * The elements also carry the producer index and a per-producer sequence
+ * number.  A FIFO queue hands the elements of a single producer to a
+ * single consumer in order, so a consumer counts every element that is
+ * older than an element it has already seen from the same producer.
+ *
+ * A relaxed queue (e.g. a sharded one) can keep the order of every producer
+ * and still hand out the elements far from the global FIFO order.  That is
+ * measured by the timestamps: a consumer counts the elements enqueued before
+ * the newest element it has already seen from any producer ("inverted"),
+ * and how much earlier they were enqueued ("late").  The strict FIFO queues
+ * see a few inversions too, as the timestamp is taken before the enqueue.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "phase.h"
+
+#define SOJOURN_SUB_BITS 3
+#define SOJOURN_BUCKETS	 (64 << SOJOURN_SUB_BITS)
+
+struct sojourn {
+	uint64_t buckets[SOJOURN_BUCKETS];
+	uint64_t count;
+	uint64_t max;
+	uint64_t reordered; /*%< Elements dequeued out of the producer order */
+	uint64_t *last;	    /*%< Last sequence number seen from every producer */
+	uint64_t newest;    /*%< The latest enqueue timestamp seen */
+	uint64_t inverted;  /*%< Elements older than the newest one seen */
+	uint64_t late;	    /*%< Sum of the lateness of the inverted elements */
+	uint64_t max_late;
+	size_t nproducers;
+};
+
+static bool sojourn_enabled = false;
+
+static inline size_t
+sojourn_bucket(uint64_t ns) {
+	if (ns < (1 << SOJOURN_SUB_BITS)) {
+		return (ns);
+	}
+
+	unsigned int msb = 63 - __builtin_clzll(ns);
+	uint64_t mantissa = (ns >> (msb - SOJOURN_SUB_BITS)) & ((1 << SOJOURN_SUB_BITS) - 1);
+
+	return (((msb - SOJOURN_SUB_BITS + 1) << SOJOURN_SUB_BITS) | mantissa);
+}
+
+/*
+ * The lowest latency that falls into the 'bucket'.
+ */
+static inline uint64_t
+sojourn_floor(size_t bucket) {
+	if (bucket < (1 << SOJOURN_SUB_BITS)) {
+		return (bucket);
+	}
+
+	unsigned int msb = (bucket >> SOJOURN_SUB_BITS) + SOJOURN_SUB_BITS - 1;
+	uint64_t mantissa = bucket & ((1 << SOJOURN_SUB_BITS) - 1);
+
+	return ((UINT64_C(1) << msb) | (mantissa << (msb - SOJOURN_SUB_BITS)));
+}
+
+static inline void
+sojourn_init(struct sojourn *sojourn, size_t nproducers) {
+	*sojourn = (struct sojourn){
+		.last = calloc(nproducers, sizeof(sojourn->last[0])),
+		.nproducers = nproducers,
+	};
+}
+
+static inline void
+sojourn_destroy(struct sojourn *sojourn) {
+	free(sojourn->last);
+	sojourn->last = NULL;
+}
+
+/*
+ * Record the element with the sequence number 'seq' from the 'producer'
+ * enqueued at 'enqueued' (as returned by phase_now()).
+ */
+static inline void
+sojourn_record(struct sojourn *sojourn, size_t producer, uint64_t seq, uint64_t enqueued) {
+	uint64_t ns = phase_now() - enqueued;
+
+	sojourn->buckets[sojourn_bucket(ns)]++;
+	sojourn->count++;
+	sojourn->max = (ns > sojourn->max) ? ns : sojourn->max;
+
+	if (seq < sojourn->last[producer]) {
+		sojourn->reordered++;
+	} else {
+		sojourn->last[producer] = seq;
+	}
+
+	if (enqueued < sojourn->newest) {
+		uint64_t late = sojourn->newest - enqueued;
+
+		sojourn->inverted++;
+		sojourn->late += late;
+		sojourn->max_late = (late > sojourn->max_late) ? late : sojourn->max_late;
+	} else {
+		sojourn->newest = enqueued;
+	}
+}
+
+static inline void
+sojourn_add(struct sojourn *sum, const struct sojourn *sojourn) {
+	for (size_t i = 0; i < SOJOURN_BUCKETS; i++) {
+		sum->buckets[i] += sojourn->buckets[i];
+	}
+	sum->count += sojourn->count;
+	sum->max = (sojourn->max > sum->max) ? sojourn->max : sum->max;
+	sum->reordered += sojourn->reordered;
+	sum->inverted += sojourn->inverted;
+	sum->late += sojourn->late;
+	sum->max_late = (sojourn->max_late > sum->max_late) ? sojourn->max_late : sum->max_late;
+}
+
+static inline uint64_t
+sojourn_percentile(const struct sojourn *sojourn, double q) {
+	uint64_t rank = (uint64_t)(q * (double)sojourn->count);
+	uint64_t seen = 0;
+
+	for (size_t i = 0; i < SOJOURN_BUCKETS; i++) {
+		seen += sojourn->buckets[i];
+		if (seen > rank) {
+			return (sojourn_floor(i));
+		}
+	}
+
+	return (sojourn->max);
+}
+
+static inline void
+sojourn_print_header(void) {
+	printf("| %10s | %10s | %10s | %10s | %10s | %10s | %10s | %10s ", "soj p50", "soj p99", "soj p99.9",
+	       "soj max", "reordered", "inverted", "late avg", "late max");
+}
+
+static inline void
+sojourn_print(const struct sojourn *sojourn) {
+	if (sojourn->count == 0) {
+		printf("| %10s | %10s | %10s | %10s | %10" PRIu64 " | %10s | %10s | %10s ", "-", "-", "-", "-",
+		       sojourn->reordered, "-", "-", "-");
+		return;
+	}
+
+	double late = (sojourn->inverted > 0) ? (double)sojourn->late / (double)sojourn->inverted : 0.0;
+
+	printf("| %8.2fus | %8.2fus | %8.2fus | %8.2fus | %10" PRIu64 " | %10" PRIu64 " | %8.2fus | %8.2fus ",
+	       (double)sojourn_percentile(sojourn, 0.50) / 1000, (double)sojourn_percentile(sojourn, 0.99) / 1000,
+	       (double)sojourn_percentile(sojourn, 0.999) / 1000, (double)sojourn->max / 1000, sojourn->reordered,
+	       sojourn->inverted, late / 1000, (double)sojourn->max_late / 1000);
+}
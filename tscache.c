@@ -0,0 +1,190 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#ifndef _LGPL_SOURCE
+#define _LGPL_SOURCE 1
+#endif
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <uv.h>
+
+#include "atomic.h"
+#include "rcu.h"
+#include "tscache.h"
+
+#define TSCACHE_CACHELINE_SIZE 64
+
+struct tscache_object {
+	atomic_uint_fast64_t generation;
+	struct tscache_object *next;
+	alignas(16) uint8_t data[];
+};
+
+struct tscache_slab {
+	alignas(TSCACHE_CACHELINE_SIZE) struct tscache_slab *next;
+};
+
+struct tscache {
+	uint64_t id;
+	size_t stride;
+	uv_mutex_t lock;
+	struct tscache_object *depot;
+	struct tscache_slab *slabs;
+};
+
+/*
+ * The per-thread magazine belongs to one cache at a time, the objects in a
+ * magazine of another cache are simply forgotten (they are still part of
+ * their slabs).
+ */
+struct tscache_magazine {
+	uint64_t id;
+	struct tscache_object *head;
+	size_t count;
+};
+
+#define tscache_object(ptr) \
+	((struct tscache_object *)((uintptr_t)(ptr) - offsetof(struct tscache_object, data)))
+
+static atomic_uint_fast64_t tscache_ids = 1;
+static thread_local struct tscache_magazine magazine;
+
+struct tscache *
+tscache_new(size_t size) {
+	struct tscache *cache = malloc(sizeof(*cache));
+	size_t stride = sizeof(struct tscache_object) + size;
+
+	*cache = (struct tscache){
+		.id = atomic_fetch_add_relaxed(&tscache_ids, 1),
+		.stride = (stride + TSCACHE_CACHELINE_SIZE - 1) & ~(size_t)(TSCACHE_CACHELINE_SIZE - 1),
+	};
+
+	int r = uv_mutex_init(&cache->lock);
+	assert(r == 0);
+
+	return (cache);
+}
+
+void
+tscache_destroy(struct tscache *cache) {
+	/* The readers might still be looking at the objects */
+	synchronize_rcu();
+
+	while (cache->slabs != NULL) {
+		struct tscache_slab *slab = cache->slabs;
+		cache->slabs = slab->next;
+		free(slab);
+	}
+
+	uv_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+static struct tscache_magazine *
+tscache_magazine(struct tscache *cache) {
+	if (magazine.id != cache->id) {
+		magazine = (struct tscache_magazine){ .id = cache->id };
+	}
+
+	return (&magazine);
+}
+
+/*
+ * Refill the magazine from the depot, or carve a new slab when the depot is
+ * empty.
+ */
+static void
+tscache_refill(struct tscache *cache, struct tscache_magazine *mag) {
+	uv_mutex_lock(&cache->lock);
+	while (cache->depot != NULL && mag->count < TSCACHE_BATCH) {
+		struct tscache_object *object = cache->depot;
+		cache->depot = object->next;
+
+		object->next = mag->head;
+		mag->head = object;
+		mag->count++;
+	}
+
+	if (mag->count == 0) {
+		struct tscache_slab *slab = aligned_alloc(TSCACHE_CACHELINE_SIZE, TSCACHE_SLAB_SIZE);
+		uint8_t *base = (uint8_t *)slab;
+
+		slab->next = cache->slabs;
+		cache->slabs = slab;
+
+		for (size_t off = sizeof(*slab); off + cache->stride <= TSCACHE_SLAB_SIZE; off += cache->stride) {
+			struct tscache_object *object = (struct tscache_object *)(base + off);
+			atomic_init(&object->generation, 0);
+
+			object->next = mag->head;
+			mag->head = object;
+			mag->count++;
+		}
+	}
+	uv_mutex_unlock(&cache->lock);
+}
+
+void *
+tscache_alloc(struct tscache *cache) {
+	struct tscache_magazine *mag = tscache_magazine(cache);
+
+	if (mag->head == NULL) {
+		tscache_refill(cache, mag);
+	}
+
+	struct tscache_object *object = mag->head;
+	mag->head = object->next;
+	mag->count--;
+
+	return (object->data);
+}
+
+void
+tscache_free(struct tscache *cache, void *ptr) {
+	struct tscache_magazine *mag = tscache_magazine(cache);
+	struct tscache_object *object = tscache_object(ptr);
+
+	/* Tell the readers that this is not the object they were looking at */
+	(void)atomic_fetch_add_release(&object->generation, 1);
+
+	object->next = mag->head;
+	mag->head = object;
+	mag->count++;
+
+	if (mag->count < 2 * TSCACHE_BATCH) {
+		return;
+	}
+
+	/* Return a batch to the depot */
+	struct tscache_object *first = mag->head, *last = mag->head;
+	for (size_t i = 1; i < TSCACHE_BATCH; i++) {
+		last = last->next;
+	}
+	mag->head = last->next;
+	mag->count -= TSCACHE_BATCH;
+
+	uv_mutex_lock(&cache->lock);
+	last->next = cache->depot;
+	cache->depot = first;
+	uv_mutex_unlock(&cache->lock);
+}
+
+uint64_t
+tscache_generation(const void *ptr) {
+	const struct tscache_object *object = tscache_object(ptr);
+
+	return (atomic_load_acquire(&object->generation));
+}
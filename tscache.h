@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Ondřej Surý
+ *
+ * SPDX-License-Identifier: WTFPL
+ */
+
+#pragma once
+
+/*! \file tscache.h
+ * Type-stable object cache for RCU-protected objects.
+ *
+ * This is the userspace counterpart of SLAB_TYPESAFE_BY_RCU: a freed
+ * object is immediately reused for a new object of the same type, without
+ * waiting for a grace period, but its memory is never reused for anything
+ * else while the cache exists.  A reader inside an RCU read-side critical
+ * section can therefore always dereference a pointer it found, but the
+ * object might have been freed and reallocated in the meantime, so the
+ * reader has to revalidate its identity: every free bumps the object's
+ * generation, and the reader compares the generation before and after it
+ * has looked at the object.
+ *
+ * The free list links live in a header in front of the object, so the
+ * object contents stay intact for the readers after the free.  The slabs
+ * are returned to the system only by tscache_destroy(), after a grace
+ * period.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TSCACHE_SLAB_SIZE
+#define TSCACHE_SLAB_SIZE (64 * 1024)
+#endif /* ifndef TSCACHE_SLAB_SIZE */
+
+/*
+ * Number of objects moved between the per-thread magazine and the shared
+ * depot at once.
+ */
+#ifndef TSCACHE_BATCH
+#define TSCACHE_BATCH 64
+#endif /* ifndef TSCACHE_BATCH */
+
+struct tscache;
+
+struct tscache *
+tscache_new(size_t size);
+
+void
+tscache_destroy(struct tscache *cache);
+/*%<
+ * Wait for a grace period and free all the slabs, all the objects must
+ * have been freed or forgotten.
+ */
+
+void *
+tscache_alloc(struct tscache *cache);
+
+void
+tscache_free(struct tscache *cache, void *ptr);
+
+uint64_t
+tscache_generation(const void *ptr);
+/*%<
+ * The generation of the object, it changes every time the object is
+ * freed.
+ */
@@ -85,3 +85,13 @@ time_microdiff(const struct timespec *t1, const struct timespec *t2) {
 
 	return (i1 - i2) / NS_PER_US;
 }
+
+static inline uint64_t
+time_nanodiff(const struct timespec *t1, const struct timespec *t2) {
+	uint64_t i1 = (uint64_t)t1->tv_sec * NS_PER_SEC + t1->tv_nsec;
+	uint64_t i2 = (uint64_t)t2->tv_sec * NS_PER_SEC + t2->tv_nsec;
+
+	assert(i1 >= i2);
+
+	return (i1 - i2);
+}